@@ -162,6 +162,14 @@ class Motif(object):
 
     The user node ids are identical in all motifs with the same
     topological_hash.
+
+    If the output was written with 'tmf --motif_structure', the
+    number of nodes, events and edges and the topological hash are
+    read from the columns 'N_nodes', 'N_events', 'N_edges' and
+    'topo_hash' instead of being calculated, so that the motifs can be
+    filtered and grouped without finding the canonical labels. The
+    events in temporal order are then in self.events_str, in the
+    format "0>1,1>2".
     """
 
     # Possible graph types when calculating isomorphism. These have
@@ -219,9 +227,13 @@ class Motif(object):
                 try:
                     val = int(fields[i])
                 except ValueError:
-                    val = float(fields[i])
-                self.__dict__[headers[i].replace('-','_')] = val
-                self.__property_names.append(headers[i].replace('-','_'))
+                    try:
+                        val = float(fields[i])
+                    except ValueError:
+                        val = fields[i]
+                name = ('events_str' if headers[i] == 'events' else headers[i].replace('-','_'))
+                self.__dict__[name] = val
+                self.__property_names.append(name)
                 i += 1;
 
     def copy(self):
@@ -263,6 +275,8 @@ class Motif(object):
 
     @property
     def nof_nodes(self):
+        if 'N_nodes' in self.__dict__:
+            return self.N_nodes
         try:
             return len(self.__nodes)
         except AttributeError:
@@ -271,6 +285,8 @@ class Motif(object):
 
     @property
     def nof_events(self):
+        if 'N_events' in self.__dict__:
+            return self.N_events
         try:
             return len(self.__events)
         except AttributeError:
@@ -279,6 +295,8 @@ class Motif(object):
 
     @property
     def nof_edges(self):
+        if 'N_edges' in self.__dict__:
+            return self.N_edges
         return len(set( frozenset((x[0],x[1])) for x in self.events.itervalues() ))
 
     @property
@@ -333,6 +351,8 @@ class Motif(object):
 
     @property
     def topological_hash(self):
+        if 'topo_hash' in self.__dict__:
+            return self.topo_hash
         try:
             return self.__topological_hash
         except AttributeError:
@@ -430,7 +430,12 @@ class MotifSelector(object):
             # Group by topology.
             hash_groups = collections.defaultdict(list)
             for h,m in self.motifs.iteritems():
-                h_topo = m.get_hash(self.arg.group_by[1], (None if self.arg.group_by[0] == 'typed' else m.basic_type_map))
+                if self.arg.group_by == ['untyped', 'graph']:
+                    # Same grouping as the untyped undirected hash,
+                    # but read from the file if available.
+                    h_topo = m.topological_hash
+                else:
+                    h_topo = m.get_hash(self.arg.group_by[1], (None if self.arg.group_by[0] == 'typed' else m.basic_type_map))
                 hash_groups[h_topo].append(h)
         else:
             hash_groups = {"all": self.motifs.keys()}
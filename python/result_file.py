@@ -0,0 +1,67 @@
+# Reading the binary result files written by 'tmf --binary_output'.
+import numpy as np
+
+HEADER_SIZE = 48
+ENTRY_SIZE = 40
+
+def read_results(filename, mmap=True):
+    """Read a binary result file.
+
+    Parameters
+    ----------
+    filename : str
+        The result file (written with --binary_output).
+    mmap : bool
+        If True, the columns are memory mapped instead of read into
+        memory.
+
+    Returns
+    -------
+    columns : dict
+        Column name -> 1D numpy array with one value per motif. The
+        names are the same as in the header of the text output. String
+        columns (e.g. 'events') are lists of str.
+    descs : list of str
+        The description of each motif, in the same order as the
+        columns.
+    """
+    header = np.fromfile(filename, dtype=np.uint8, count=HEADER_SIZE)
+    if header[:8].tostring() != "TMFRES  ":
+        raise ValueError("'%s' is not a binary result file." % (filename,))
+    version, n_rows, n_cols, _ = header[8:24].view(np.uint32)
+    if version != 1:
+        raise ValueError("Unknown result file version %d." % (version,))
+    desc_offsets_pos, descs_pos, descs_size = header[24:48].view(np.uint64)
+
+    directory = np.fromfile(filename, dtype=np.uint8,
+                            count=HEADER_SIZE + n_cols*ENTRY_SIZE)[HEADER_SIZE:]
+    columns = {}
+    for i in range(n_cols):
+        entry = directory[i*ENTRY_SIZE:(i+1)*ENTRY_SIZE]
+        name = entry[:24].tostring().rstrip("\0")
+        type_str = entry[24:32].tostring().rstrip("\0")
+        offset = int(entry[32:40].view(np.uint64)[0])
+        if type_str == "str":
+            columns[name] = __read_strings(filename, offset, n_rows)
+            continue
+        dtype = np.dtype(type_str)
+        if mmap:
+            columns[name] = np.memmap(filename, dtype=dtype, mode='r',
+                                      offset=offset, shape=(n_rows,))
+        else:
+            with open(filename, 'rb') as f:
+                f.seek(offset)
+                columns[name] = np.fromfile(f, dtype=dtype, count=n_rows)
+
+    descs = __read_strings(filename, desc_offsets_pos, n_rows, descs_pos)
+    return columns, descs
+
+def __read_strings(filename, offset, n_rows, chars_pos=None):
+    """Read n_rows strings stored as uint64 offsets followed by the
+    characters (at chars_pos if given)."""
+    with open(filename, 'rb') as f:
+        f.seek(offset)
+        offsets = np.fromfile(f, dtype=np.uint64, count=n_rows+1)
+        f.seek(chars_pos if chars_pos is not None else offset + 8*(n_rows+1))
+        chars = f.read(int(offsets[-1]))
+    return [chars[offsets[i]:offsets[i+1]] for i in range(n_rows)]
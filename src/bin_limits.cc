@@ -48,8 +48,9 @@ unsigned int initialize_limit_seq(LimitSeq& limit_seq, const NetType& net, doubl
       cum_edges += rit->second;
     }
 
-  std::cout << "   Highest weight edges to omit: " << cum_edges 
-	    << " (those with w > " << rit->first << ")" << std::endl;
+  std::cout << "   Highest weight edges to omit: " << cum_edges;
+  if (rit != weights.rend()) std::cout << " (those with w > " << rit->first << ")";
+  std::cout << std::endl;
 
   // Create limit sequence where each weight has its own bin.
   limit_seq.clear();
@@ -67,20 +68,103 @@ unsigned int initialize_limit_seq(LimitSeq& limit_seq, const NetType& net, doubl
 bool bin_limits_from_limit_seq(const LimitSeq& limit_seq, std::set<unsigned int>& limits)
 {
   limits.clear();
+  if (limit_seq.empty()) return false;
   LimitSeq::const_iterator lcit = limit_seq.begin();
   for (; lcit != limit_seq.end(); ++lcit) limits.insert(lcit->left);
   limits.insert(limit_seq.rbegin()->right + 1);
   return true;
 }
 
+/* Merge the interval following 'it' into 'it'. */
+static void merge_next(LimitSeq& limit_seq, LimitSeq::iterator it)
+{
+  LimitSeq::iterator next = it;
+  ++next;
+  it->right = next->right;
+  it->count += next->count;
+  limit_seq.erase(next);
+}
+
+// Create bin limits so that each bin has at least bin_min_count edges.
+bool get_limits_by_min_count(const NetType& net,
+			     std::set<unsigned int>& limits,
+			     unsigned int bin_min_count,
+			     double p_leave_out)
+{
+  LimitSeq limit_seq;
+  initialize_limit_seq(limit_seq, net, p_leave_out);
+  if (limit_seq.empty()) return false;
+
+  // Starting from the smallest weights, grow each bin until it has
+  // enough edges. If the last bin remains too small, it is merged
+  // with the one before it.
+  LimitSeq::iterator it = limit_seq.begin();
+  while (it != limit_seq.end())
+    {
+      LimitSeq::iterator next = it;
+      ++next;
+      if (next == limit_seq.end()) break;
+      if (it->count < bin_min_count) merge_next(limit_seq, it);
+      else it = next;
+    }
+  if (limit_seq.size() > 1 && limit_seq.back().count < bin_min_count)
+    {
+      merge_next(limit_seq, --(--limit_seq.end()));
+    }
+
+  //std::cerr << "   Limit sequence: " << limit_seq << std::endl;
+  return bin_limits_from_limit_seq(limit_seq, limits);
+}
+
+// Create bin limits so that there are at most N_bins bins with
+// approximately equal number of edges.
+bool get_limits_by_N_bin(const NetType& net,
+			 std::set<unsigned int>& limits,
+			 unsigned int N_bins,
+			 double p_leave_out)
+{
+  LimitSeq limit_seq;
+  initialize_limit_seq(limit_seq, net, p_leave_out);
+  if (limit_seq.empty() || N_bins == 0) return false;
+
+  unsigned int total = 0;
+  for (LimitSeq::const_iterator lcit = limit_seq.begin(); lcit != limit_seq.end(); ++lcit)
+    total += lcit->count;
+
+  // Bin i ends once the cumulative count reaches (i+1)/N_bins of the
+  // total. A single weight may cover several quantiles, so there can
+  // be less than N_bins bins.
+  unsigned int i_bin = 0;
+  unsigned long long cum_count = 0;
+  LimitSeq::iterator it = limit_seq.begin();
+  cum_count += it->count;
+  while (true)
+    {
+      LimitSeq::iterator next = it;
+      ++next;
+      if (next == limit_seq.end()) break;
+      if (cum_count*N_bins < (unsigned long long)(i_bin + 1)*total)
+	{
+	  cum_count += next->count;
+	  merge_next(limit_seq, it);
+	}
+      else
+	{
+	  while (cum_count*N_bins >= (unsigned long long)(i_bin + 1)*total) i_bin++;
+	  cum_count += next->count;
+	  it = next;
+	}
+    }
+
+  //std::cerr << "   Limit sequence: " << limit_seq << std::endl;
+  return bin_limits_from_limit_seq(limit_seq, limits);
+}
+
 // Create unbinned bin limits (each weight has its own bin).
 bool get_limits_unbinned(const NetType& net, std::set<unsigned int>& limits, double p_leave_out)
 {
   // Initialize limit sequence, then construct the bin limits.
   LimitSeq limit_seq;
   initialize_limit_seq(limit_seq, net, p_leave_out);
-  bin_limits_from_limit_seq(limit_seq, limits);
-
-  //std::cerr << "   Weight bin limits: " << limits << std::endl;
-  return true;
+  return bin_limits_from_limit_seq(limit_seq, limits);
 }
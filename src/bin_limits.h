@@ -49,6 +49,10 @@ bool get_limits_by_N_bin(const NetType& net,
 			 double p_leave_out);
 
 /* Create unbinned bin limits (each weight has its own bin).
+ *
+ * All three functions return false and leave `limits` empty if no
+ * edge with non-zero weight remains after leaving out the largest
+ * weights.
  */
 bool get_limits_unbinned(const NetType& net,
 			 std::set<unsigned int>& limits,
@@ -14,56 +14,149 @@ Lauri Kovanen (2/2012)
 #include <set>
 #include <vector>
 #include <algorithm>
+#include <iostream>
 #include <assert.h>
 #include "std_printers.h"
+#include "serialize.h"
+#include "rng.h"
+
+/* Class: BinIndex
+
+   Maps a value to the index of its bin in constant time with a
+   lookup table that has one entry for each integer between the
+   smallest and the largest bin limit. A single BinIndex may be
+   shared by any number of Binner objects with the same limits.
+*/
+typedef unsigned int limit_type;
+typedef unsigned int index_type;
+typedef unsigned int bin_id;
+class BinIndex
+{
+ private:
+  limit_type min_val, max_val;
+  std::vector<index_type> index_of; // index_of[pos - min_val]
+  
+ public:
+  BinIndex(): min_val(0), max_val(0), index_of() {};
+  bool Init(const std::set<limit_type>& limits);
+
+  /* The number of bins. */
+  unsigned int size() const { return (index_of.empty() ? 0 : index_of.back() + 1); };
+
+  /* Returns false if pos is outside bin limits. */
+  bool get_index(limit_type pos, index_type& index) const
+  {
+    if (pos < min_val || pos >= max_val) return false;
+    index = index_of[pos - min_val];
+    return true;
+  };
+};
+
+inline bool BinIndex::Init(const std::set<limit_type>& limits)
+{
+  index_of.clear();
+  if (limits.size() < 2) return false;
+  min_val = *limits.begin();
+  max_val = *(--limits.end());
+  index_of.reserve(max_val - min_val);
+  std::set<limit_type>::const_iterator it = limits.begin();
+  index_type i = 0;
+  for (++it; it != limits.end(); ++it, ++i)
+    {
+      while (min_val + index_of.size() < *it) index_of.push_back(i);
+    }
+  return true;
+}
 
 /* Class: Binner
 
    A multidimensional binner object. The bin limits are identical in
    each dimension. The template argument gives the data type.
 
-   The bin limits must be unsigned int (for now).
+   The bin limits must be unsigned int (for now). The bin indices in
+   all dimensions are packed into a single 64-bit key, and the bins
+   are found from an open addressing hash table. If the indices do
+   not fit in 64 bits, each bin also stores its indices and the
+   packed key (which then wraps around) is used only as the hash.
+   The values in each bin are stored as a sorted array of (value,
+   count) pairs.
 */
-typedef unsigned int limit_type;
-typedef unsigned int index_type;
 template<typename value_type> class Binner
 {
-  typedef std::map<limit_type, index_type> BinLimits;
-  typedef std::map<value_type, unsigned int> ValueDist; // value, count
-  typedef std::map<std::vector<index_type>, std::pair<ValueDist, unsigned int> > DataMap;
+  typedef unsigned long long key_type;
+  typedef std::vector<std::pair<value_type, unsigned int> > ValueDist; // value, count
+  typedef std::vector<index_type> IndexVector;
+  struct BinData
+  {
+    key_type key;
+    IndexVector indices; // Empty if the key is packed.
+    unsigned int count;
+    ValueDist values;
+  BinData(key_type key, const IndexVector& indices): key(key), indices(indices), count(0), values() {};
+  };
+  static const bin_id NO_BIN = (bin_id)-1;
 
  private:
-  BinLimits bin_limits;
+  BinIndex own_index; // Used only if initialized with limits.
+  const BinIndex* bin_index;
   unsigned int dim;
-  limit_type min_val, max_val;
-  DataMap data;
-
-  /* Auxiliary functions used by find() to find indices for the
-     position. Both return false if position is outside bin limits. */
-  bool get_index(limit_type pos, index_type& index);
-  bool get_indices(const std::vector<limit_type>& pos, std::vector<index_type>& indices);
-
-  /* Find the distribution at given position. Returns false if the
-     position is invalid (outside bin limits). If the value is not
-     found, it = data.end(). */
-  bool find(const std::vector<limit_type>& pos, typename DataMap::iterator& it);
+  bool packed; // True if the key identifies the bin.
+  std::vector<bin_id> slots; // Hash table, NO_BIN marks empty slot.
+  std::vector<BinData> bins;
+
+  /* Alias tables created by freeze(). The table of bin 'b' occupies
+     positions alias_start[b] ... alias_start[b+1]-1 of the other
+     vectors; alias_index holds positions in the same vectors. */
+  bool frozen;
+  std::vector<unsigned int> alias_start;
+  std::vector<value_type> alias_value;
+  std::vector<double> alias_prob;
+  std::vector<unsigned int> alias_index;
+
+  /* Get the key for the position, and the indices if the key is not
+     packed. Returns false if position is outside bin limits. */
+  bool get_key(const std::vector<limit_type>& pos, key_type& key, IndexVector& indices) const;
+
+  /* Position of key in the hash table: either the slot of the bin
+     with this key, or the empty slot where it should be added. */
+  size_t find_slot(key_type key, const IndexVector& indices) const;
+
+  /* Rebuild the hash table with n_slots slots (a power of two). */
+  void rehash(size_t n_slots);
+
+  /* Find the bin at given position. Returns false if the position is
+     invalid (outside bin limits). If there are no values at that
+     position, bin = NO_BIN. */
+  bool find(const std::vector<limit_type>& pos, bin_id& bin) const;
 
   /* Extract sum from value distribution. */
   value_type get_sum(const ValueDist& valueDist);
 
-  /* Convert distribution to cumulative distribution. */
-  void create_cumulative();
-
-  /* Return a single random value from distribution. */
-  value_type get_random(const ValueDist& valueDist, unsigned int count);
+  /* Return the value of the alias table of 'bin' that corresponds
+     to the uniform random number u in [0,1). */
+  value_type draw(bin_id bin, double u) const;
 
  public:
   Binner();
+  Binner(const Binner& other);
+  Binner& operator=(const Binner& other);
+
+  /* Initialize with the given limits, or with a shared bin index
+     that must exist as long as the binner is used. */
   bool Init(const std::set<limit_type>& limits, unsigned int dim);
+  bool Init(const BinIndex& bin_index, unsigned int dim);
   bool is_initialized() { return dim > 0; };
 
-  /* Add a value to distribution. */
+  /* The number of bins with values, i.e. the upper bound of the ids
+     returned by add(). */
+  unsigned int size() const { return bins.size(); };
+
+  /* Add a value to distribution. The second version also returns the
+     id of the bin where the value was added; the id can be used
+     later to access the same bin without looking up the bin indices
+     again. */
   bool add(const std::vector<limit_type>& pos, value_type val);
+  bool add(const std::vector<limit_type>& pos, value_type val, bin_id& bin);
 
   /* Both get_mean() and get_sum() return false if pos is not within
      bin limits or if no values corresponding to pos have been
@@ -74,78 +167,187 @@ template<typename value_type> class Binner
   /* get_count() returns false only if pos is outside bin limits. */
   bool get_count(const std::vector<limit_type>& pos, unsigned int& res);
 
+  /* Create the alias tables used for drawing random values. Should
+     be called once all values have been added; get_random() calls
+     it automatically if values have been added since the last
+     call. */
+  void freeze();
+
   /* Get a random value(s) from distribution corresponding to
      pos. Returns false if pos is outside bin limits or the
      distribution is empty. */
-  bool get_random(const std::vector<limit_type>& pos, value_type& res);
-  bool get_random(const std::vector<limit_type>& pos, std::vector<value_type>& res);
+  bool get_random(const std::vector<limit_type>& pos, value_type& res, RandomStream& rng);
+  bool get_random(const std::vector<limit_type>& pos, std::vector<value_type>& res, RandomStream& rng);
+
+  /* Returns true if the bin returned by add() has only one distinct
+     value, which is then saved in 'res'. Random values from such
+     bins do not need random numbers. */
+  bool is_constant(bin_id bin, value_type& res);
+
+  /* Get the random value from the bin returned by add() that
+     corresponds to the uniform random number u in [0,1). */
+  value_type get_random(bin_id bin, double u);
+
+  /* Get random values from the bin returned by add(), one for each
+     uniform random number in u. */
+  void get_random(bin_id bin, const std::vector<double>& u, std::vector<value_type>& res);
+
+  /* Get the mean and variance of the distribution in the bin
+     returned by add(), and the probability that a random value from
+     the distribution is non-zero. */
+  void get_moments(bin_id bin, double& mean, double& var, double& p_nonzero);
+
+  /* Write the binner into a binary stream and read it back. The
+     bin index is not saved; read() must be given a bin index with
+     the same limits as the one used when the binner was written. */
+  void write(std::ostream& os) const;
+  bool read(std::istream& is, const BinIndex& bin_index);
 
   void print_data();
 };
 
+template<typename value_type> const bin_id Binner<value_type>::NO_BIN;
+
 template<typename value_type> Binner<value_type>::Binner() 
-: bin_limits(), dim(0), data() {}
+: own_index(), bin_index(NULL), dim(0), packed(true), slots(), bins(), frozen(false) {}
+
+// Copying must not copy the pointer to the own index of 'other'.
+template<typename value_type> Binner<value_type>::Binner(const Binner& other) 
+: own_index(), bin_index(NULL), dim(0), packed(true), slots(), bins(), frozen(false) 
+{
+  *this = other;
+}
+
+template<typename value_type> 
+Binner<value_type>& Binner<value_type>::operator=(const Binner& other)
+{
+  if (this == &other) return *this;
+  own_index = other.own_index;
+  bin_index = (other.bin_index == &other.own_index ? &own_index : other.bin_index);
+  dim = other.dim;
+  packed = other.packed;
+  slots = other.slots;
+  bins = other.bins;
+  frozen = other.frozen;
+  alias_start = other.alias_start;
+  alias_value = other.alias_value;
+  alias_prob = other.alias_prob;
+  alias_index = other.alias_index;
+  return *this;
+}
 
 template<typename value_type> bool Binner<value_type>::Init(const std::set<limit_type>& limits, unsigned int dim)
 {
-  this->dim = dim;
-  index_type i = 0;
-  for (std::set<limit_type>::const_iterator it = limits.begin(); it != limits.end(); ++it)
+  if (!own_index.Init(limits)) return false;
+  return Init(own_index, dim);
+}
+
+template<typename value_type> bool Binner<value_type>::Init(const BinIndex& bin_index, unsigned int dim)
+{
+  // The key is packed if the largest key, n_bins^dim - 1, fits in
+  // key_type.
+  key_type n_bins = bin_index.size();
+  key_type max_keys = 1;
+  packed = true;
+  for (unsigned int d = 0; packed && d < dim; d++)
     {
-      bin_limits[*it] = i;
-      i++;
+      if (n_bins > 1 && max_keys > ((key_type)-1)/n_bins) packed = false;
+      max_keys *= n_bins;
     }
-  min_val = *limits.begin();
-  max_val = *(--limits.end());
-  //std::cerr << "bin_limits: " << bin_limits << " (" << min_val << ", " << max_val << ")\n";
+  this->bin_index = &bin_index;
+  this->dim = dim;
+  slots.assign(16, NO_BIN);
+  bins.clear();
+  frozen = false;
   return true;
 }
 
 template<typename value_type> 
 bool Binner<value_type>::add(const std::vector<limit_type>& pos, value_type val)
 {
-  std::vector<index_type> indices(dim);
-  if (!get_indices(pos, indices)) return false;
-  std::pair<ValueDist, unsigned int>& data_pair = data[indices];
-  data_pair.first[val]++;
-  data_pair.second++;
-  return true;
+  bin_id bin;
+  return add(pos, val, bin);
 }
 
 template<typename value_type> 
-bool Binner<value_type>::get_indices(const std::vector<limit_type>& pos, std::vector<index_type>& indices)
+bool Binner<value_type>::add(const std::vector<limit_type>& pos, value_type val, bin_id& bin)
 {
-  //std::cerr << pos << std::endl;
-  //std::cerr << indices << std::endl;
-  assert(pos.size() == indices.size());
-  std::vector<index_type>::iterator index = indices.begin();
-  for (std::vector<limit_type>::const_iterator it = pos.begin(); it != pos.end(); ++it)
+  key_type key;
+  IndexVector indices;
+  if (!get_key(pos, key, indices)) return false;
+  size_t slot = find_slot(key, indices);
+  bin = slots[slot];
+  if (bin == NO_BIN)
+    {
+      bin = bins.size();
+      slots[slot] = bin;
+      bins.push_back(BinData(key, indices));
+      if (2*bins.size() > slots.size()) rehash(2*slots.size());
+    }
+
+  // Insert the value into the sorted array.
+  BinData& bin_data = bins[bin];
+  typename ValueDist::iterator vit = std::lower_bound(bin_data.values.begin(), bin_data.values.end(),
+						      std::make_pair(val, 0u));
+  if (vit == bin_data.values.end() || vit->first != val)
     {
-      if (!get_index(*it, *index)) return false;
-      ++index;
+      vit = bin_data.values.insert(vit, std::make_pair(val, 0u));
     }
+  vit->second++;
+  bin_data.count++;
+  frozen = false;
   return true;
 }
 
 template<typename value_type> 
-bool Binner<value_type>::get_index(limit_type pos, index_type& index)
+bool Binner<value_type>::get_key(const std::vector<limit_type>& pos, key_type& key, IndexVector& indices) const
 {
-  //std::cerr << "Looking for " << pos;
-  if (pos < min_val || pos >= max_val) {
-    //std::cerr << " (not found, "<< min_val << " " << max_val <<")\n";
-    return false;
-  }
-  index = (bin_limits.upper_bound(pos))->second - 1;
-  //std::cerr << " (found at "<<index<<")\n";
+  assert(pos.size() == dim);
+  const key_type n_bins = bin_index->size();
+  key = 0;
+  if (!packed) indices.resize(dim);
+  index_type index;
+  for (unsigned int d = dim; d-- > 0; )
+    {
+      if (!bin_index->get_index(pos[d], index)) return false;
+      key = key*n_bins + index;
+      if (!packed) indices[d] = index;
+    }
   return true;
 }
 
 template<typename value_type> 
-bool Binner<value_type>::find(const std::vector<limit_type>& pos, typename DataMap::iterator& it)
+size_t Binner<value_type>::find_slot(key_type key, const IndexVector& indices) const
 {
-  std::vector<index_type> indices(dim);
-  if (!get_indices(pos, indices)) return false;
-  it = data.find(indices);
+  // Mix the bits of the key (the finalizer of MurmurHash3), then
+  // probe linearly.
+  key_type h = key;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  const size_t mask = slots.size() - 1;
+  size_t slot = h & mask;
+  while (slots[slot] != NO_BIN && (bins[slots[slot]].key != key || bins[slots[slot]].indices != indices))
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+template<typename value_type> 
+void Binner<value_type>::rehash(size_t n_slots)
+{
+  slots.assign(n_slots, NO_BIN);
+  for (bin_id bin = 0; bin < bins.size(); bin++) slots[find_slot(bins[bin].key, bins[bin].indices)] = bin;
+}
+
+template<typename value_type> 
+bool Binner<value_type>::find(const std::vector<limit_type>& pos, bin_id& bin) const
+{
+  key_type key;
+  IndexVector indices;
+  if (!get_key(pos, key, indices)) return false;
+  bin = slots[find_slot(key, indices)];
   return true;
 }
 
@@ -163,71 +365,207 @@ value_type Binner<value_type>::get_sum(const ValueDist& valueDist)
 template<typename value_type> 
 bool Binner<value_type>::get_mean(const std::vector<limit_type>& pos, double& res)
 {
-  typename DataMap::iterator it;
-  if (!find(pos, it) || it == data.end()) return false;
-  res = ((double)get_sum(it->second.first))/((double)it->second.second);
+  bin_id bin;
+  if (!find(pos, bin) || bin == NO_BIN) return false;
+  res = ((double)get_sum(bins[bin].values))/((double)bins[bin].count);
   return true;
 }
 
 template<typename value_type> 
 bool Binner<value_type>::get_count(const std::vector<limit_type>& pos, unsigned int& res)
 {
-  typename DataMap::iterator it;
-  if (!find(pos, it)) return false;
-  if (it == data.end()) res = 0.0;
-  else res = it->second.second;
+  bin_id bin;
+  if (!find(pos, bin)) return false;
+  if (bin == NO_BIN) res = 0;
+  else res = bins[bin].count;
   return true;
 }
 
 template<typename value_type> 
 bool Binner<value_type>::get_sum(const std::vector<limit_type>& pos, value_type& res)
 {
-  typename DataMap::iterator it;
-  if (!find(pos, it) || it == data.end()) return false;
-  res = get_sum(it->second.first);
+  bin_id bin;
+  if (!find(pos, bin) || bin == NO_BIN) return false;
+  res = get_sum(bins[bin].values);
   return true;
 }
 
 template<typename value_type> 
-value_type Binner<value_type>::get_random(const ValueDist& valueDist, unsigned int count)
+void Binner<value_type>::freeze()
 {
-  unsigned int i = 1 + (unsigned int)(count*(rand()/(RAND_MAX+1.0)));
-  unsigned int cum_count = 0;
-  for (typename ValueDist::const_iterator vit = valueDist.begin(); vit != valueDist.end(); ++vit)
+  alias_start.assign(1, 0);
+  alias_value.clear();
+  alias_prob.clear();
+  alias_index.clear();
+
+  // Vose's alias method. The weight of each value is scaled so that
+  // the average weight is 'count'; with integer weights the tables
+  // are exact.
+  std::vector<unsigned long long> w;
+  std::vector<unsigned int> small, large;
+  for (typename std::vector<BinData>::const_iterator bit = bins.begin(); bit != bins.end(); ++bit)
     {
-      cum_count += vit->second;
-      //std::cerr << "i "<<i<<", cum_count "<<cum_count<<", value "<<res<<std::endl;	  
-      if (cum_count >= i) return vit->first;
+      const unsigned int start = alias_value.size();
+      const unsigned int n = bit->values.size();
+      const unsigned long long count = bit->count;
+      w.clear();
+      small.clear();
+      large.clear();
+      for (typename ValueDist::const_iterator vit = bit->values.begin(); vit != bit->values.end(); ++vit)
+	{
+	  if ((unsigned long long)vit->second*n < count) small.push_back(w.size());
+	  else large.push_back(w.size());
+	  w.push_back((unsigned long long)vit->second*n);
+	  alias_value.push_back(vit->first);
+	}
+      alias_prob.resize(start + n, 1.0);
+      alias_index.resize(start + n);
+      for (unsigned int i = 0; i < n; i++) alias_index[start + i] = start + i;
+
+      while (!small.empty() && !large.empty())
+	{
+	  unsigned int s = small.back(); small.pop_back();
+	  unsigned int l = large.back();
+	  alias_prob[start + s] = w[s]/(double)count;
+	  alias_index[start + s] = start + l;
+	  w[l] -= count - w[s];
+	  if (w[l] < count)
+	    {
+	      large.pop_back();
+	      small.push_back(l);
+	    }
+	}
+      alias_start.push_back(alias_value.size());
     }
-  return 0; // This should never happen.
+  frozen = true;
+}
+
+template<typename value_type> 
+value_type Binner<value_type>::draw(bin_id bin, double u) const
+{
+  const unsigned int start = alias_start[bin];
+  const unsigned int n = alias_start[bin+1] - start;
+  double x = u*n;
+  unsigned int i = (unsigned int)x;
+  if (i >= n) i = n - 1;
+  const unsigned int k = start + i;
+  return (x - i < alias_prob[k] ? alias_value[k] : alias_value[alias_index[k]]);
+}
+
+template<typename value_type> 
+bool Binner<value_type>::get_random(const std::vector<limit_type>& pos, value_type& res, RandomStream& rng)
+{
+  bin_id bin;
+  if (!find(pos, bin) || bin == NO_BIN) return false;
+  res = get_random(bin, rng.next_double());
+  return true;
+}
+
+template<typename value_type> 
+bool Binner<value_type>::get_random(const std::vector<limit_type>& pos, std::vector<value_type>& res, RandomStream& rng)
+{
+  bin_id bin;
+  if (!find(pos, bin) || bin == NO_BIN) return false;
+  for (unsigned int i = 0; i < res.size(); i++) res[i] = get_random(bin, rng.next_double());
+  return true;
 }
 
 template<typename value_type> 
-bool Binner<value_type>::get_random(const std::vector<limit_type>& pos, value_type& res)
+bool Binner<value_type>::is_constant(bin_id bin, value_type& res)
 {
-  typename DataMap::iterator it;
-  if (!find(pos, it) || it == data.end()) return false;
-  res = get_random(it->second.first, it->second.second);
+  if (!frozen) freeze();
+  if (alias_start[bin+1] - alias_start[bin] != 1) return false;
+  res = alias_value[alias_start[bin]];
   return true;
 }
 
 template<typename value_type> 
-bool Binner<value_type>::get_random(const std::vector<limit_type>& pos, std::vector<value_type>& res)
+value_type Binner<value_type>::get_random(bin_id bin, double u)
 {
-  typename DataMap::iterator it;
-  if (!find(pos, it) || it == data.end()) return false;
-  for (typename std::vector<value_type>::iterator res_it = res.begin(); res_it != res.end(); ++res_it)
+  if (!frozen) freeze();
+  return draw(bin, u);
+}
+
+template<typename value_type> 
+void Binner<value_type>::get_random(bin_id bin, const std::vector<double>& u, std::vector<value_type>& res)
+{
+  if (!frozen) freeze();
+  res.resize(u.size());
+  for (unsigned int i = 0; i < u.size(); i++)
     {
-      *res_it = get_random(it->second.first, it->second.second);
+      res[i] = draw(bin, u[i]);
     }
-  return true;
+}
+
+template<typename value_type> 
+void Binner<value_type>::get_moments(bin_id bin, double& mean, double& var, double& p_nonzero)
+{
+  const BinData& bin_data = bins[bin];
+  double sum = 0, sum2 = 0, nonzero = 0;
+  for (typename ValueDist::const_iterator vit = bin_data.values.begin(); vit != bin_data.values.end(); ++vit)
+    {
+      double v = (double)vit->first;
+      sum += v * vit->second;
+      sum2 += v * v * vit->second;
+      if (vit->first != 0) nonzero += vit->second;
+    }
+  double count = (double)bin_data.count;
+  mean = sum/count;
+  var = sum2/count - mean*mean;
+  if (var < 0) var = 0; // Rounding errors.
+  p_nonzero = nonzero/count;
 }
 
 template<typename value_type> 
 void Binner<value_type>::print_data()
 {
-  std::cerr << data << std::endl;
+  const key_type n_bins = bin_index->size();
+  std::vector<index_type> indices(dim);
+  for (typename std::vector<BinData>::const_iterator bit = bins.begin(); bit != bins.end(); ++bit)
+    {
+      key_type key = bit->key;
+      for (unsigned int d = 0; d < dim; d++)
+	{
+	  indices[d] = key % n_bins;
+	  key /= n_bins;
+	}
+      if (!packed) indices = bit->indices;
+      std::cerr << indices << ":" << bit->values << std::endl;
+    }
+}
+
+template<typename value_type> 
+void Binner<value_type>::write(std::ostream& os) const
+{
+  write_value(os, dim);
+  write_value(os, (unsigned int)bins.size());
+  for (typename std::vector<BinData>::const_iterator bit = bins.begin(); bit != bins.end(); ++bit)
+    {
+      write_value(os, bit->key);
+      if (!packed) write_vector(os, bit->indices);
+      write_value(os, bit->count);
+      write_vector(os, bit->values);
+    }
 }
 
+template<typename value_type> 
+bool Binner<value_type>::read(std::istream& is, const BinIndex& bin_index)
+{
+  unsigned int file_dim, n_bins;
+  if (!read_value(is, file_dim) || !read_value(is, n_bins)) return false;
+  if (!Init(bin_index, file_dim)) return false;
+  for (unsigned int i = 0; i < n_bins; i++)
+    {
+      key_type key;
+      IndexVector indices;
+      if (!read_value(is, key) || (!packed && !read_vector(is, indices))) return false;
+      bins.push_back(BinData(key, indices));
+      if (!read_value(is, bins.back().count) || !read_vector(is, bins.back().values)) return false;
+    }
+  size_t n_slots = slots.size();
+  while (2*bins.size() > n_slots) n_slots *= 2;
+  rehash(n_slots);
+  return true;
+}
 
 #endif
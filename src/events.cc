@@ -4,6 +4,9 @@
  */
 #include <iostream>
 #include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "events.h"
 
 const event_id Event::null_event = std::numeric_limits<event_id>::max();
@@ -140,12 +143,75 @@ Events::Events(std::istream& event_file):events(1000),
         if (!node_events[i].empty()) node_events[i].Init();
     }
 
+  index_edges();
+
   std::cout << "   Events read, found "
 	    << get_nof_nodes() << " nodes and " 
 	    << get_nof_events() << " events.\n";
 
 }
 
+void Events::index_edges()
+{
+  const unsigned int N_events = get_nof_events();
+  const unsigned int N_nodes = get_nof_nodes();
+
+  // Group the events by source node: from_events holds the (target,
+  // event) pairs of node v at from_start[v], ..., from_start[v+1]-1.
+  std::vector<size_t> from_start(N_nodes + 1, 0);
+  for (event_id i = 0; i < N_events; ++i) from_start[events[i].from() + 1]++;
+  for (node_id v = 0; v < N_nodes; ++v) from_start[v+1] += from_start[v];
+  std::vector<std::pair<node_id, event_id> > from_events(N_events);
+  {
+    std::vector<size_t> pos(from_start.begin(), from_start.end() - 1);
+    for (event_id i = 0; i < N_events; ++i)
+      {
+	from_events[pos[events[i].from()]++] = std::make_pair(events[i].to(), i);
+      }
+  }
+
+  // Sort each group by target node and count the distinct targets.
+  std::vector<edge_id> n_out(N_nodes, 0);
+#pragma omp parallel for schedule(dynamic, 256)
+  for (int v = 0; v < (int)N_nodes; ++v)
+    {
+      std::sort(from_events.begin() + from_start[v], from_events.begin() + from_start[v+1]);
+      for (size_t k = from_start[v]; k < from_start[v+1]; ++k)
+	{
+	  if (k == from_start[v] || from_events[k].first != from_events[k-1].first) n_out[v]++;
+	}
+    }
+
+  // Assign the ids in order of (from, to).
+  edge_start.assign(N_nodes + 1, 0);
+  for (node_id v = 0; v < N_nodes; ++v) edge_start[v+1] = edge_start[v] + n_out[v];
+  event_edges.resize(N_events);
+  edge_from.resize(edge_start[N_nodes]);
+  edge_to.resize(edge_start[N_nodes]);
+#pragma omp parallel for schedule(dynamic, 256)
+  for (int v = 0; v < (int)N_nodes; ++v)
+    {
+      edge_id e = edge_start[v];
+      for (size_t k = from_start[v]; k < from_start[v+1]; ++k)
+	{
+	  if (k > from_start[v] && from_events[k].first != from_events[k-1].first) ++e;
+	  edge_from[e] = v;
+	  edge_to[e] = from_events[k].first;
+	  event_edges[from_events[k].second] = e;
+	}
+    }
+}
+
+edge_id Events::find_edge(node_id from, node_id to) const
+{
+  if (from >= get_nof_nodes()) return Event::null_event;
+  std::vector<node_id>::const_iterator first = edge_to.begin() + edge_start[from];
+  std::vector<node_id>::const_iterator last = edge_to.begin() + edge_start[from+1];
+  std::vector<node_id>::const_iterator it = std::lower_bound(first, last, to);
+  if (it == last || *it != to) return Event::null_event;
+  return it - edge_to.begin();
+}
+
 void Events::switch_times(event_id i, event_id j)
 {
   node_id i_from = events[i].from();
@@ -157,6 +223,7 @@ void Events::switch_times(event_id i, event_id j)
   // related to time and id.
   events[i].Reset(j_from, j_to);
   events[j].Reset(i_from, i_to);
+  std::swap(event_edges[i], event_edges[j]);
   
   //std::cerr << "Remove events ...\n";
   node_events[i_from].replace(i,j);
@@ -165,40 +232,90 @@ void Events::switch_times(event_id i, event_id j)
   node_events[j_to].replace(j,i);
 }
 
-void Events::shuffle()
+void Events::shuffle(RandomStream& rng)
 {
-  unsigned int N_events = get_nof_events();
-
-  //srand(time(NULL));
+  const unsigned int N_events = get_nof_events();
+  const unsigned int N_nodes = get_nof_nodes();
 
-  for (event_id i = 0; i < N_events; ++i)
+  // Fisher-Yates permutation of the edges and types over the fixed
+  // time slots.
+  for (event_id i = 0; i + 1 < N_events; ++i)
     {
       // Get random number from U(i,N_events-1).
-      double diff = ((N_events-i)*((double)rand()))/(RAND_MAX+1.0);
-      event_id j = i + (event_id)diff;
-      std::cerr << "Shuffling events " << i << " and " << j << std::endl;
-      /*
-      std::cerr << "  Events of node fr("<<i<<")=" << events[i].from() << ": ";
-      node_events[events[i].from()].print();
-      std::cerr << "  Events of node fr("<<i<<")=" << events[i].to() << ": ";
-      node_events[events[i].from()].print();
-      std::cerr << "  Events of node fr("<<j<<")=" << events[i].from() << ": ";
-      node_events[events[j].from()].print();
-      std::cerr << "  Events of node fr("<<j<<")=" << events[i].to() << ": ";
-      node_events[events[j].from()].print();
-      */
-      if (i != j) switch_times(i, j);
+      event_id j = i + rng.next_below(N_events-i);
+      if (i == j) continue;
+      node_id i_from = events[i].from();
+      node_id i_to = events[i].to();
+      short int i_type = events[i].type();
+      events[i].Reset(events[j].from(), events[j].to());
+      events[i].set_type(events[j].type());
+      events[j].Reset(i_from, i_to);
+      events[j].set_type(i_type);
+      std::swap(event_edges[i], event_edges[j]);
+    }
+  for (event_id i = 0; i < N_events; ++i) events[i].set_component(Event::null_event);
+
+  // Rebuild the node-event index with a counting sort. The number of
+  // events of each node does not change, so the trees keep their
+  // sizes and only their values need to be replaced. The events are
+  // divided into chunks that are sorted in parallel; chunk c writes
+  // the events of node v after those of the chunks before it.
+  std::vector<size_t> node_start(N_nodes + 1, 0);
+  for (node_id v = 0; v < N_nodes; ++v) node_start[v+1] = node_start[v] + node_events[v].size();
+  std::vector<event_id> sorted(node_start[N_nodes]);
+
+  int N_chunks = 1;
+#ifdef _OPENMP
+  N_chunks = std::max(1, std::min(omp_get_max_threads(), (int)(N_events/std::max(1U, N_nodes))));
+#endif
+  std::vector<size_t> pos((size_t)N_chunks*N_nodes, 0);
+#pragma omp parallel for
+  for (int c = 0; c < N_chunks; ++c)
+    {
+      size_t* chunk_pos = &pos[(size_t)c*N_nodes];
+      event_id i_end = (event_id)(((unsigned long long)N_events*(c+1))/N_chunks);
+      for (event_id i = (event_id)(((unsigned long long)N_events*c)/N_chunks); i < i_end; ++i)
+	{
+	  chunk_pos[events[i].from()]++;
+	  chunk_pos[events[i].to()]++;
+	}
+    }
+#pragma omp parallel for schedule(dynamic, 1024)
+  for (int v = 0; v < (int)N_nodes; ++v)
+    {
+      size_t p = node_start[v];
+      for (int c = 0; c < N_chunks; ++c)
+	{
+	  size_t n = pos[(size_t)c*N_nodes + v];
+	  pos[(size_t)c*N_nodes + v] = p;
+	  p += n;
+	}
+    }
+#pragma omp parallel for
+  for (int c = 0; c < N_chunks; ++c)
+    {
+      size_t* chunk_pos = &pos[(size_t)c*N_nodes];
+      event_id i_end = (event_id)(((unsigned long long)N_events*(c+1))/N_chunks);
+      for (event_id i = (event_id)(((unsigned long long)N_events*c)/N_chunks); i < i_end; ++i)
+	{
+	  sorted[chunk_pos[events[i].from()]++] = i;
+	  sorted[chunk_pos[events[i].to()]++] = i;
+	}
+    }
+#pragma omp parallel for schedule(dynamic, 64)
+  for (int v = 0; v < (int)N_nodes; ++v)
+    {
+      if (!node_events[v].empty()) node_events[v].assign_sorted(&sorted[node_start[v]]);
     }
 };
 
-void Events::shuffle_event_types()
+void Events::shuffle_event_types(RandomStream& rng)
 {
   unsigned int N_events = get_nof_events();
   for (event_id i = 0; i < N_events; ++i)
     {
       // Get random number from U(i,N_events-1).
-      double diff = ((N_events-i)*((double)rand()))/(RAND_MAX+1.0);
-      event_id j = i + (event_id)diff;
+      event_id j = i + rng.next_below(N_events-i);
       //std::cerr << "Shuffling types of events " << i << " and " << j << std::endl;
       if (i != j)
 	{
@@ -209,35 +326,34 @@ void Events::shuffle_event_types()
     }
 };
 
-bool Events::shuffle_edge_types()
+bool Events::get_edge_types(std::vector<short int>& edge_types) const
+{
+  const short int no_type = std::numeric_limits<short int>::min();
+  edge_types.assign(get_nof_edges(), no_type);
+  for (event_id i = 0; i < get_nof_events(); ++i)
+    {
+      short int& curr_type = edge_types[event_edges[i]];
+      if (curr_type == no_type) curr_type = events[i].type();
+      else if (curr_type != events[i].type()) return false;
+    }
+  return true;
+}
+
+bool Events::shuffle_edge_types(RandomStream& rng)
 {
   // Get the type of each edge. Returns false if for some edge there
   // are two types of events. We collect the types in a separate
   // vector so they can be easily shuffled.
-  unsigned int i_edge = 0;
-  std::map<std::pair<node_id, node_id>, unsigned int> edges;
   std::vector<short int> edge_types;
-  for (event_id i = 0; i < get_nof_events(); ++i)
-    {
-      std::pair<node_id, node_id> curr_edge(events[i].from(), events[i].to());
-      std::map<std::pair<node_id, node_id>, unsigned int>::const_iterator ed_it = edges.find(curr_edge);
-      if (ed_it == edges.end()) 
-	{
-	  edges[curr_edge] = i_edge;
-	  edge_types.push_back(events[i].type());
-	  i_edge++;
-	}
-      else if (edge_types[ed_it->second] != events[i].type()) return false;
-    }
+  if (!get_edge_types(edge_types)) return false;
 
   // Shuffle event types.
-  std::random_shuffle(edge_types.begin(), edge_types.end());
+  shuffle_range(edge_types.begin(), edge_types.end(), rng);
 
   // Re-assign randomized event types.
   for (event_id i = 0; i < get_nof_events(); ++i)
     {
-      std::pair<node_id, node_id> curr_edge(events[i].from(), events[i].to());
-      events[i].set_type(edge_types[edges[curr_edge]]);
+      events[i].set_type(edge_types[event_edges[i]]);
     }
   return true;
 };
@@ -249,112 +365,204 @@ bool Events::check_overlap(event_id i_first, event_id i_second)
   return false;
 }
 
-void Events::shuffle_constrained(unsigned int N_shuffle)
+bool Events::switch_allowed(event_id i, event_id j)
+{
+  // The only two events that might overlap after the switch are
+  // those with id exactly smaller and larger than j: the first
+  // one might have started before j but end during j; the second
+  // one might start during j. There can be other events that
+  // overlap, but if these two do not overlap we know that no
+  // other event will either.
+  event_id i0 = i;
+  event_id i1 = j;
+  for (int e_ = 0; e_ < 2; ++e_)
+    {
+      Event const& e = events[i0];
+      node_id tmp_node = e.from();
+      for (int u_ = 0; u_ < 2; ++u_)
+	{
+	  event_id i2;
+	      
+	  i2 = node_events[tmp_node].find_prev(i1, Event::null_event);
+	  if (i2 == i0) node_events[tmp_node].find_prev(i2, Event::null_event);
+	  if (i2 != Event::null_event && check_overlap(i2, i1)) return false;
+
+	  i2 = node_events[tmp_node].find_next(i1, Event::null_event);
+	  if (i2 == i0) node_events[tmp_node].find_next(i2, Event::null_event);
+	  if (i2 != Event::null_event && check_overlap(i1, i2)) return false;
+
+	  tmp_node = e.to(); // Repeat for the other node.
+	}
+      i0 = j; i1 = i; // Repeat for the other event.
+    }
+  return true;
+}
+
+void Events::node_gap_stats(double& mean, double& error)
+{
+  const int N_trees = node_events.size();
+#pragma omp parallel for schedule(dynamic, 64)
+  for (int v = 0; v < N_trees; ++v) node_events[v].restore_order();
+
+  double sum = 0, sum2 = 0, n = 0;
+  for (unsigned int v = 0; v < node_events.size(); ++v)
+    {
+      if (node_events[v].empty()) continue;
+      node_iterator it = node_events[v].begin();
+      unsigned int t_prev = events[*it].start_time();
+      for (++it; it != node_events[v].end(); ++it)
+	{
+	  unsigned int t = events[*it].start_time();
+	  double x = log(1.0 + (t - t_prev));
+	  sum += x;
+	  sum2 += x*x;
+	  n += 1;
+	  t_prev = t;
+	}
+    }
+  mean = (n > 0 ? sum/n : 0);
+  error = (n > 1 ? sqrt(std::max(0.0, sum2/n - mean*mean)/(n - 1)) : 0);
+}
+
+void Events::shuffle_constrained(unsigned int N_shuffle, RandomStream& rng,
+				 unsigned int batch_size, double mixing_target,
+				 std::ostream& output)
 {
   unsigned int N_nodes = get_nof_nodes();
   unsigned int N_events = get_nof_events();
+  if (batch_size == 0) batch_size = std::max(1U, N_nodes/64);
 
-  std::cerr << N_nodes << " nodes, " << N_events << " events." << std::endl << std::flush;
+  output << N_nodes << " nodes, " << N_events << " events." << std::endl << std::flush;
 
   // Randomize first the time stamps, then build up again the pointers
   // to next and previous events.
-  unsigned int n_shuffles = 0;
-  unsigned int shuffle_tries = 0;
-  while (n_shuffles < N_events*N_shuffle)
+  const unsigned long long N_target = (unsigned long long)N_events*N_shuffle;
+  unsigned long long n_shuffles = 0;
+  unsigned long long shuffle_tries = 0;
+  unsigned long long n_dropped = 0;
+  unsigned long long next_report = 10000000;
+
+  // node_batch[v] is the last batch with a candidate at node v.
+  std::vector<unsigned int> node_batch(N_nodes, 0);
+  unsigned int batch = 0;
+  std::vector<event_id> cand_i, cand_j;
+  std::vector<char> accepted;
+
+  // Mixing diagnostics.
+  std::vector<char> switched(N_events, 0);
+  unsigned int n_unswitched = N_events;
+  double gap_0, gap_prev, gap_curr, gap_error;
+  node_gap_stats(gap_0, gap_error);
+  gap_prev = gap_0;
+  const unsigned long long check_interval = std::max(1U, N_events/2);
+  unsigned long long next_check = check_interval;
+
+  while (n_shuffles < N_target)
     {
-      ++shuffle_tries;
-
-      if (shuffle_tries % 10000000 == 0) 
+      ++batch;
+
+      // Draw the candidates of this batch. This is done serially so
+      // that the result does not depend on the number of threads.
+      unsigned int N_cand = (unsigned int)std::min((unsigned long long)batch_size, N_target - n_shuffles);
+      cand_i.clear();
+      cand_j.clear();
+      for (unsigned int c = 0; c < N_cand; ++c)
 	{
-	  float p_done = ((float)n_shuffles)/(N_events*N_shuffle);
-	  std::cerr << "    Shuffled " << n_shuffles << " out of " 
-		    << shuffle_tries << " tries (" 
-		    << (int)(100*p_done) << "% done)"
-		    << std::endl << std::flush;
+	  event_id i,j;
+	  i = rng.next_below(N_events);
+	  do {
+	    j = rng.next_below(N_events);
+	  } while (events[i].type() != events[j].type() || i == j);
+
+	  node_id nodes[4] = {events[i].from(), events[i].to(), events[j].from(), events[j].to()};
+	  for (int k = 0; k < 4; ++k) __builtin_prefetch(node_events[nodes[k]].nodes, 0, 3);
+	  bool conflict = false;
+	  for (int k = 0; k < 4; ++k) conflict = conflict || node_batch[nodes[k]] == batch;
+	  if (conflict)
+	    {
+	      ++n_dropped;
+	      continue;
+	    }
+	  for (int k = 0; k < 4; ++k) node_batch[nodes[k]] = batch;
+	  cand_i.push_back(i);
+	  cand_j.push_back(j);
 	}
 
-      event_id i,j;
-      i = (event_id)(N_events*(rand()/(RAND_MAX+1.0)));
-      __builtin_prefetch(node_events[events[i].from()].nodes, 0, 3);
-      __builtin_prefetch(node_events[events[i].to()].nodes, 0, 3);
-
-      do {
-	j = (event_id)(N_events*(rand()/(RAND_MAX+1.0)));
-      } while (events[i].type() != events[j].type() || i == j);
-      __builtin_prefetch(node_events[events[j].from()].nodes, 0, 3);
-      __builtin_prefetch(node_events[events[j].to()].nodes, 0, 3);
-
-      //std::cerr << "Trying to shuffle " << i << " and " << j << std::endl;
-
-      // The only two events that might overlap after the switch are
-      // those with id exactly smaller and larger than j: the first
-      // one might have started before j but end during j; the second
-      // one might start during j. There can be other events that
-      // overlap, but if these two do not overlap we know that no
-      // other event will either.
-
-      bool overlap_found = false;
-      event_id i0 = i;
-      event_id i1 = j;
-      for (int e_ = 0; e_ < 2; ++e_)
+      // The candidates have no common nodes, so they can be checked
+      // and switched independently. If we got this far with a
+      // candidate we know the switch is valid, i.e. after making the
+      // switch there will be no overlapping events.
+      const int N_batch = cand_i.size();
+      accepted.resize(N_batch);
+#pragma omp parallel for schedule(dynamic, 16) if (N_batch > 256)
+      for (int c = 0; c < N_batch; ++c)
 	{
-	  Event const& e = events[i0];
-	  node_id tmp_node = e.from();
-	  for (int u_ = 0; u_ < 2; ++u_)
-	    {
-	      event_id i2;
-	      
-	      i2 = node_events[tmp_node].find_prev(i1, Event::null_event);
-	      if (i2 == i0) node_events[tmp_node].find_prev(i2, Event::null_event);
-	      if (i2 != Event::null_event && check_overlap(i2, i1))
-		{
-		  overlap_found = true; break;
-		}
+	  accepted[c] = switch_allowed(cand_i[c], cand_j[c]);
+	  if (accepted[c]) switch_times(cand_i[c], cand_j[c]);
+	}
 
-	      i2 = node_events[tmp_node].find_next(i1, Event::null_event);
-	      if (i2 == i0) node_events[tmp_node].find_next(i2, Event::null_event);
-	      if (i2 != Event::null_event && check_overlap(i1, i2))
-		{
-		  overlap_found = true; break;
-		}
+      // Increase the successful shuffles count.
+      shuffle_tries += N_batch;
+      for (int c = 0; c < N_batch; ++c)
+	{
+	  if (!accepted[c]) continue;
+	  ++n_shuffles;
+	  if (!switched[cand_i[c]]) { switched[cand_i[c]] = 1; --n_unswitched; }
+	  if (!switched[cand_j[c]]) { switched[cand_j[c]] = 1; --n_unswitched; }
+	}
 
-	      tmp_node = e.to(); // Repeat for the other node.
-	    }
-	  if (overlap_found) break;
-	  
-	  i0 = j; i1 = i; // Repeat for the other event.
+      if (shuffle_tries >= next_report) 
+	{
+	  next_report += 10000000;
+	  float p_done = ((float)n_shuffles)/N_target;
+	  output << "    Shuffled " << n_shuffles << " out of " 
+		 << shuffle_tries << " tries (" 
+		 << (int)(100*p_done) << "% done)"
+		 << std::endl << std::flush;
 	}
-      if (overlap_found) continue;
-	  
-      // If we got this far we know the switch is valid, i.e. after
-      // making the switch there will be no overlapping events.
-      //std::cerr << "Shuffling events " << i << " and " << j << std::endl;
-      switch_times(i,j);
 
-      // Increase the successful shuffles count.
-      ++n_shuffles;
+      // Check the mixing and stop if the target has been reached.
+      if (mixing_target > 0 && n_shuffles >= next_check && n_shuffles < N_target)
+	{
+	  next_check += check_interval;
+	  node_gap_stats(gap_curr, gap_error);
+	  double f_unswitched = ((double)n_unswitched)/N_events;
+	  double change = fabs(gap_curr - gap_prev);
+	  output << "    Mixing after " << ((double)n_shuffles)/N_events << " x N_events: "
+		 << 100*f_unswitched << "% of events never switched, mean log inter-event time "
+		 << gap_curr << " (change " << change << ")\n";
+	  gap_prev = gap_curr;
+	  if (f_unswitched <= mixing_target
+	      && (change <= mixing_target*fabs(gap_curr - gap_0) || change <= 2*gap_error)) break;
+	}
 
       //std::cerr << "Check events:" << std::endl;
       //check_events(); // FOR DEBUGGING ONLY!
     }
 
-  // Restore order of the underlying data structures of node events after shuffling.
-  std::cerr << "Restore order ...\n";
-  std::vector<event_tree>::iterator uit;
-  for (uit = node_events.begin(); uit != node_events.end(); ++uit) uit->restore_order();
-
-  std::cerr << "Accepted " << n_shuffles << "/" << shuffle_tries 
-	    << " switches during shuffling.\n";
+  // Restore order of the underlying data structures of node events
+  // after shuffling, and calculate the final mixing diagnostics.
+  output << "Restore order ...\n";
+  node_gap_stats(gap_curr, gap_error);
+
+  output << "Accepted " << n_shuffles << "/" << shuffle_tries 
+	 << " switches during shuffling";
+  if (n_dropped) output << " (" << n_dropped << " candidates dropped due to conflicts in batches)";
+  output << ".\n";
+  output << "Mixing after " << ((double)n_shuffles)/N_events << " x N_events: "
+	 << 100*((double)n_unswitched)/N_events << "% of events never switched, "
+	 << "mean log inter-event time " << gap_0 << " -> " << gap_curr
+	 << " (+-" << gap_error << ").\n";
 };
 
-
-void Events::shuffle_constrained_corr(unsigned int N_shuffle, unsigned int N_corr)
+void Events::shuffle_constrained_corr(unsigned int N_shuffle, unsigned int N_corr,
+				      RandomStream& rng, std::ostream& output)
 {
   unsigned int N_nodes = get_nof_nodes();
   unsigned int N_events = get_nof_events();
 
-  std::cerr << N_nodes << " nodes, " << N_events << " events." << std::endl << std::flush;
-  std::cerr << "Shuffling a total of " << N_events*N_shuffle << " times." << std::endl << std::flush;
+  output << N_nodes << " nodes, " << N_events << " events." << std::endl << std::flush;
+  output << "Shuffling a total of " << N_events*N_shuffle << " times." << std::endl << std::flush;
 
   unsigned int n_shuffles = 0;
   unsigned int shuffle_tries = 0;
@@ -365,17 +573,17 @@ void Events::shuffle_constrained_corr(unsigned int N_shuffle, unsigned int N_cor
       if (shuffle_tries % 10000000 == 0) 
 	{
 	  float p_done = ((float)n_shuffles)/(N_events*N_shuffle);
-	  std::cerr << "    Shuffled " << n_shuffles << " out of " 
-		    << shuffle_tries << " tries (" 
-		    << (int)(100*p_done) << "% done)"
-		    << std::endl << std::flush;
+	  output << "    Shuffled " << n_shuffles << " out of " 
+		 << shuffle_tries << " tries (" 
+		 << (int)(100*p_done) << "% done)"
+		 << std::endl << std::flush;
 	}
 
       bool overlap_found = false;
 
       // Get the first event.
       event_id i;
-      i = (event_id)(N_events*(rand()/(RAND_MAX+1.0)));
+      i = rng.next_below(N_events);
       __builtin_prefetch(node_events[events[i].from()].nodes, 0, 3);
       __builtin_prefetch(node_events[events[i].to()].nodes, 0, 3);
       Event const& e_i = events[i];
@@ -390,7 +598,7 @@ void Events::shuffle_constrained_corr(unsigned int N_shuffle, unsigned int N_cor
 	  // Get another random event ...
 	  event_id j_try;
 	  do {
-	    j_try = (event_id)(N_events*(rand()/(RAND_MAX+1.0)));
+	    j_try = rng.next_below(N_events);
 	  } while (events[i].type() != events[j_try].type() || i == j_try);
 
 	  // ... and calculate how close it would be to other events
@@ -486,12 +694,12 @@ void Events::shuffle_constrained_corr(unsigned int N_shuffle, unsigned int N_cor
     }
 
   // Restore order of the underlying data structures of node events after shuffling.
-  std::cerr << "Restore order ...\n";
+  output << "Restore order ...\n";
   std::vector<event_tree>::iterator uit;
   for (uit = node_events.begin(); uit != node_events.end(); ++uit) uit->restore_order();
 
-  std::cerr << "Accepted " << n_shuffles << "/" << shuffle_tries 
-	    << " switches during shuffling.\n";
+  output << "Accepted " << n_shuffles << "/" << shuffle_tries 
+	 << " switches during shuffling.\n";
 };
 
 void Events::print() const
@@ -630,6 +838,23 @@ void Events::prev_immediate_events(event_id e_id, EventMMap& prev_events) const
   return;
 }
 
+uint64_t Events::digest() const
+{
+  const uint64_t FNV_prime = 1099511628211ULL;
+  uint64_t h = 14695981039346656037ULL;
+  for (std::vector<Event>::const_iterator it = events.begin(); it != events.end(); ++it)
+    {
+      uint32_t fields[5] = {it->start_time(), it->duration(), it->from(), it->to(), (uint32_t)(uint16_t)it->type()};
+      for (int k = 0; k < 5; ++k)
+	for (int b = 0; b < 4; ++b)
+	  {
+	    h ^= (fields[k] >> (8*b)) & 0xff;
+	    h *= FNV_prime;
+	  }
+    }
+  return h;
+}
+
 void Events::check_events() const
 {
   // Go through all events and make sure that the event is listed for
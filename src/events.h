@@ -21,9 +21,11 @@
 #include <math.h>
 #include "fixed_tree.h"
 #include "std_printers.h"
+#include "rng.h"
 
 typedef uint32_t event_id;
 typedef uint32_t node_id;
+typedef uint32_t edge_id;
 typedef FixedTree<event_id> event_tree;
 typedef event_tree::iterator node_iterator;
 typedef std::multimap<unsigned int, event_id> EventMMap;
@@ -91,6 +93,22 @@ class Events
    */
   std::vector<event_tree> node_events;
 
+  /* Dense ids of the directed edges (from, to), ordered by from and
+     then by to. event_edges[i] is the edge of event i; the edges of
+     node v are edge_start[v], ..., edge_start[v+1]-1. The shuffling
+     methods keep event_edges up to date.
+   */
+  std::vector<edge_id> event_edges;
+  std::vector<edge_id> edge_start;
+  std::vector<node_id> edge_from;
+  std::vector<node_id> edge_to;
+
+  /* Give each directed edge a dense id. The events are grouped by
+     the source node with a counting sort, and each group is then
+     sorted by the target node (in parallel if compiled with
+     OpenMP). */
+  void index_edges();
+
   /* The first and last time in data. */
   unsigned int t_first, t_last, t_last_start; 
 
@@ -106,6 +124,19 @@ class Events
    */
   bool check_overlap(event_id i_first, event_id i_second);
 
+  /* Return true if switching the times of events i and j does not
+     create overlapping events. Reads only the events of the nodes of
+     i and j.
+   */
+  bool switch_allowed(event_id i, event_id j);
+
+  /* Restore the order of node_events and calculate the mean of
+     log(1 + dt) over the inter-event times dt of consecutive events
+     of each node, and the standard error of the mean. Used for
+     monitoring the mixing of time shuffling.
+   */
+  void node_gap_stats(double& mean, double& error);
+
  public:
 
   inline unsigned int size() const {return events.size();};
@@ -115,27 +146,44 @@ class Events
   inline unsigned int last_time() const {return t_last;};
   inline unsigned int last_start_time() const {return t_last_start;};
 
+  /* Interface for the dense edge ids. find_edge() returns
+     Event::null_event if there are no events from 'from' to 'to'. */
+  inline unsigned int get_nof_edges() const {return edge_to.size();};
+  inline edge_id edge(event_id i) const {return event_edges[i];};
+  inline node_id edge_source(edge_id e) const {return edge_from[e];};
+  inline node_id edge_target(edge_id e) const {return edge_to[e];};
+  edge_id find_edge(node_id from, node_id to) const;
+
   /* Time difference between two events. */
   inline unsigned int dt(event_id i_1, event_id i_2) const 
   { 
     return events[i_2].start_time()-events[i_1].end_time();
   }
 
-  /* Randomly shuffle event times. This method will also reset the
-     component id of all events.
+  /* Randomly shuffle event times. The edges and types of the events
+     are permuted uniformly over the time slots, so events of a node
+     may overlap afterwards. The node-event index is then rebuilt
+     with a counting sort (in parallel if compiled with OpenMP). This
+     method will also reset the component id of all events. All
+     shuffling methods take their random numbers from 'rng'.
   */
-  void shuffle();
+  void shuffle(RandomStream& rng);
 
   /* Randomly shuffle event types.
    */
-  void shuffle_event_types();
+  void shuffle_event_types(RandomStream& rng);
 
   /* Randomly shuffle event types assuming all events on a given edge
      have the same type. Returns false if this assumption fails. Note
      that this method does not retain the number of events of each
      type, but the number of edges of each type.
    */
-  bool shuffle_edge_types();
+  bool shuffle_edge_types(RandomStream& rng);
+
+  /* The event type of each edge, indexed by the dense edge id.
+     Returns false if some edge has events of more than one type.
+   */
+  bool get_edge_types(std::vector<short int>& edge_types) const;
 
   /* At each time step two random events are selected for
      shuffling. The total number of (valid) selections is
@@ -151,8 +199,31 @@ class Events
 	    6               0.000614 %
 	    7               0.0000832 %
 	    8               0.0000113 %
+
+     The candidate switches are drawn in batches of 'batch_size'. A
+     candidate that shares a node with an earlier candidate of the
+     same batch is dropped, and the remaining candidates are checked
+     and switched in parallel (if compiled with OpenMP). Because a
+     switch does not change the set of nodes of the two events, the
+     dropping is symmetric and the stationary distribution is the
+     same as with batch_size = 1, which is the serial algorithm. The
+     result depends on the seed and batch_size, but not on the number
+     of threads. If batch_size is 0, N_nodes/64 is used.
+
+     Two mixing diagnostics are reported at the end: the fraction of
+     events that were never switched, and the mean log inter-event
+     time of nodes (see node_gap_stats()) before and after shuffling.
+     If mixing_target > 0, N_shuffle is the maximum, and the shuffling
+     stops at the first check (after every N_events/2 switches) where
+     at most the fraction mixing_target of events is unswitched and
+     the inter-event statistic changed since the previous check by at
+     most mixing_target times its total change, or by at most twice
+     its standard error. Progress and diagnostics are written to
+     'output'.
   */
-  void shuffle_constrained(unsigned int N_shuffle);
+  void shuffle_constrained(unsigned int N_shuffle, RandomStream& rng,
+			   unsigned int batch_size = 1, double mixing_target = 0,
+			   std::ostream& output = std::cerr);
 
   /* Shuffling with artificial correlation. At each of the
      N_events*N_shuffle iterations selects first one event i for
@@ -160,12 +231,18 @@ class Events
      that gives closest distance to other event of the nodes in
      events i. "N_corr = 1" corresponds to unbiased shuffling.
   */
-  void shuffle_constrained_corr(unsigned int N_shuffle, unsigned int N_corr);
+  void shuffle_constrained_corr(unsigned int N_shuffle, unsigned int N_corr,
+				RandomStream& rng, std::ostream& output = std::cerr);
 
   /* Check that the events are properly constructed.
    */
   void check_events() const;
 
+  /* A 64-bit hash (FNV-1a) of the time, duration, nodes and type of
+     all events in their current order. Used for recognizing the
+     input in cached results. */
+  uint64_t digest() const;
+
   // The constructor reads in the events from a file.
   Events(std::istream& event_file);
   ~Events() {};
@@ -185,6 +185,11 @@ private:
   void replace(T old_value, T new_value);
   void restore_order();
 
+  /* Replace all values of the tree by size() values given in sorted
+     order. The internal array will be sorted afterwards.
+   */
+  void assign_sorted(const T* sorted_values);
+
   /* Bidirectional iterator interface. The iterator assumes the
      internal array is sorted. The only method that destroys sorting
      is replace(), so make sure to call restore_order() after calling
@@ -314,6 +319,14 @@ void FixedTree<T>::restore_order()
   //debug_print(nodes);
 }
 
+template<typename T>
+void FixedTree<T>::assign_sorted(const T* sorted_values)
+{
+  if (nodes == NULL) return;
+  for (unsigned int i = 0; i < _size; ++i) nodes[i].value = sorted_values[i];
+  root = build_children(0,_size-1);
+}
+
 template<typename T>
 void FixedTree<T>::sorted_array_copy(FixedNode<T> **new_nodes, node_id i)
 {
@@ -0,0 +1,272 @@
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "location_cache.h"
+#include "serialize.h"
+
+static const char* CACHE_TAG = "TMFLOCS ";
+static const unsigned int CACHE_VERSION = 2;
+static const char* CHECKPOINT_TAG = "TMFCHKPT";
+static const unsigned int CHECKPOINT_VERSION = 1;
+
+static void write_key(std::ostream& os, const LocationCacheKey& key)
+{
+  write_value(os, key.events_digest);
+  write_value(os, key.tw);
+  write_value(os, key.max_size);
+  write_value(os, key.time_gap);
+  write_value(os, key.maximal);
+  write_value(os, key.shard);
+  write_value(os, key.n_shards);
+}
+
+static bool read_key(std::istream& is, LocationCacheKey& key)
+{
+  return (read_value(is, key.events_digest) && read_value(is, key.tw) &&
+	  read_value(is, key.max_size) && read_value(is, key.time_gap) &&
+	  read_value(is, key.maximal) && read_value(is, key.shard) &&
+	  read_value(is, key.n_shards));
+}
+
+static bool same_key(const LocationCacheKey& a, const LocationCacheKey& b)
+{
+  return (a.events_digest == b.events_digest && a.tw == b.tw &&
+	  a.max_size == b.max_size && a.time_gap == b.time_gap &&
+	  a.maximal == b.maximal && a.shard == b.shard &&
+	  a.n_shards == b.n_shards);
+}
+
+// Each location is written as the number of edges, the edges and
+// the count.
+static void write_locations(std::ostream& os, const EdgeVectorMap& locationMap)
+{
+  write_value(os, (unsigned long long)locationMap.size());
+  for (EdgeVectorMap::const_iterator l_it = locationMap.begin(); l_it != locationMap.end(); ++l_it)
+    {
+      write_value(os, (unsigned int)l_it->first.size());
+      for (EdgeVector::const_iterator e_it = l_it->first.begin(); e_it != l_it->first.end(); ++e_it)
+	{
+	  write_value(os, e_it->from);
+	  write_value(os, e_it->to);
+	  write_value(os, e_it->type);
+	}
+      write_value(os, l_it->second);
+    }
+}
+
+// The locations were written in the order of the map, so each one
+// is inserted at the end.
+static bool read_locations(std::istream& is, EdgeVectorMap& locationMap)
+{
+  unsigned long long n_locations;
+  bool ok = read_value(is, n_locations);
+  for (unsigned long long i = 0; ok && i < n_locations; i++)
+    {
+      unsigned int n_edges, count;
+      ok = read_value(is, n_edges);
+      EdgeVector edges;
+      Edge edge;
+      for (unsigned int k = 0; ok && k < n_edges; k++)
+	{
+	  ok = read_value(is, edge.from) && read_value(is, edge.to) && read_value(is, edge.type);
+	  if (ok) edges.push_back(edge);
+	}
+      ok = ok && read_value(is, count);
+      if (ok) locationMap.insert(locationMap.end(), std::make_pair(edges, count));
+    }
+  return ok;
+}
+
+std::string shard_file_name(const std::string& fileName, unsigned int i)
+{
+  std::ostringstream os;
+  os << fileName << "." << i;
+  return os.str();
+}
+
+bool write_location_cache(const std::string& fileName,
+			  const LocationCacheKey& key,
+			  const TypedEdgeWeights& typed_weights,
+			  const EdgeVectorMap& locationMap)
+{
+  std::ofstream os(fileName.c_str(), std::ios::binary);
+  if (os.fail()) return false;
+  write_header(os, CACHE_TAG, CACHE_VERSION);
+  write_key(os, key);
+
+  write_value(os, (unsigned int)typed_weights.size());
+  for (TypedEdgeWeights::const_iterator tw_it = typed_weights.begin(); tw_it != typed_weights.end(); ++tw_it)
+    {
+      write_value(os, tw_it->first);
+      write_vector(os, tw_it->second);
+    }
+
+  write_locations(os, locationMap);
+
+  os.close();
+  return !os.fail();
+}
+
+bool read_location_cache(const std::string& fileName,
+			 const LocationCacheKey& key,
+			 TypedEdgeWeights& typed_weights,
+			 EdgeVectorMap& locationMap)
+{
+  typed_weights.clear();
+  locationMap.clear();
+
+  std::ifstream is(fileName.c_str(), std::ios::binary);
+  if (is.fail() || !read_header(is, CACHE_TAG, CACHE_VERSION)) return false;
+  LocationCacheKey file_key;
+  if (!read_key(is, file_key) || !same_key(file_key, key)) return false;
+
+  bool ok = true;
+  unsigned int n_types;
+  if (!read_value(is, n_types)) return false;
+  for (unsigned int i = 0; ok && i < n_types; i++)
+    {
+      short int type;
+      ok = read_value(is, type) && read_vector(is, typed_weights[type]);
+    }
+
+  ok = ok && read_locations(is, locationMap);
+
+  if (!ok)
+    {
+      typed_weights.clear();
+      locationMap.clear();
+    }
+  return ok;
+}
+
+bool read_location_cache_shards(const std::string& fileName,
+				const LocationCacheKey& key,
+				TypedEdgeWeights& typed_weights,
+				EdgeVectorMap& locationMap)
+{
+  typed_weights.clear();
+  locationMap.clear();
+
+  // Each subgraph was found by exactly one shard, so the counts of
+  // the same location are summed. The typed weights are those of
+  // the whole data in every shard.
+  LocationCacheKey shard_key(key);
+  for (shard_key.shard = 0; shard_key.shard < key.n_shards; shard_key.shard++)
+    {
+      EdgeVectorMap shard_map;
+      if (!read_location_cache(shard_file_name(fileName, shard_key.shard), shard_key, typed_weights, shard_map))
+	{
+	  typed_weights.clear();
+	  locationMap.clear();
+	  return false;
+	}
+      EdgeVectorMap::iterator hint = locationMap.begin();
+      for (EdgeVectorMap::const_iterator l_it = shard_map.begin(); l_it != shard_map.end(); ++l_it)
+	{
+	  hint = locationMap.insert(hint, std::make_pair(l_it->first, 0u));
+	  hint->second += l_it->second;
+	}
+    }
+  return true;
+}
+
+LocationCheckpoint::LocationCheckpoint(const std::string& fileName,
+				       const LocationCacheKey& key,
+				       unsigned int interval)
+  :fileName(fileName), key(key), interval(interval), last_write(time(NULL)),
+   n_updates(0), writer(0)
+{}
+
+LocationCheckpoint::~LocationCheckpoint()
+{
+  wait_writer();
+}
+
+bool LocationCheckpoint::read(unsigned long long& done, EdgeVectorMap& locationMap) const
+{
+  done = 0;
+  locationMap.clear();
+
+  std::ifstream is(fileName.c_str(), std::ios::binary);
+  if (is.fail() || !read_header(is, CHECKPOINT_TAG, CHECKPOINT_VERSION)) return false;
+  LocationCacheKey file_key;
+  if (!read_key(is, file_key) || !same_key(file_key, key)) return false;
+  if (!read_value(is, done) || !read_locations(is, locationMap))
+    {
+      done = 0;
+      locationMap.clear();
+      return false;
+    }
+  return true;
+}
+
+void LocationCheckpoint::update(unsigned long long done, const EdgeVectorMap& locationMap)
+{
+  // Most root events take far less than a second, so the clock is
+  // read only on every CLOCK_CHECK_INTERVAL:th call.
+  if (++n_updates < CLOCK_CHECK_INTERVAL) return;
+  n_updates = 0;
+  time_t now = time(NULL);
+  if (now < last_write + (time_t)interval) return;
+
+  // Skip this checkpoint if the previous one is still being written.
+  if (writer > 0 && waitpid(writer, NULL, WNOHANG) == 0) return;
+  writer = 0;
+  last_write = now;
+
+  // The child process gets a copy of the locations as they are now,
+  // so the search continues while it writes them.
+  pid_t pid = fork();
+  if (pid == 0) _exit(write(done, locationMap) ? 0 : 1);
+  if (pid > 0) writer = pid;
+  else write(done, locationMap);
+}
+
+bool LocationCheckpoint::finish(unsigned long long done, const EdgeVectorMap& locationMap)
+{
+  wait_writer();
+  last_write = time(NULL);
+  return write(done, locationMap);
+}
+
+/* Flush the file or directory 'name' to disk. */
+static bool sync_path(const std::string& name)
+{
+  int fd = open(name.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  bool ok = (fsync(fd) == 0);
+  return (close(fd) == 0) && ok;
+}
+
+bool LocationCheckpoint::write(unsigned long long done, const EdgeVectorMap& locationMap) const
+{
+  // Write into a temporary file first so that an interrupted write
+  // leaves the previous checkpoint intact.
+  const std::string tmp_name = fileName + ".tmp";
+  std::ofstream os(tmp_name.c_str(), std::ios::binary);
+  if (os.fail()) return false;
+  write_header(os, CHECKPOINT_TAG, CHECKPOINT_VERSION);
+  write_key(os, key);
+  write_value(os, done);
+  write_locations(os, locationMap);
+  os.close();
+  if (os.fail()) return false;
+
+  // The data must be on disk before the rename replaces the previous
+  // checkpoint, and the rename itself is made durable by syncing the
+  // directory.
+  if (!sync_path(tmp_name) || std::rename(tmp_name.c_str(), fileName.c_str()) != 0) return false;
+  std::string::size_type slash = fileName.rfind('/');
+  return sync_path(slash == std::string::npos ? "." : fileName.substr(0, slash + 1));
+}
+
+void LocationCheckpoint::wait_writer()
+{
+  if (writer > 0) waitpid(writer, NULL, 0);
+  writer = 0;
+}
@@ -0,0 +1,118 @@
+/*
+Cache of the motif locations found in the data.
+
+Finding the motifs at each location is the slowest part of a run
+that does not depend on the node types. The cache file stores the
+location counts and the typed weights of the aggregate network so
+that runs with other node types (or shuffled node types) of the same
+events can skip the motif search. The cache is identified by a key
+consisting of a digest of the events and the parameters that affect
+the locations.
+
+A large run can also be split by time into shards: shard I of N
+finds only the subgraphs whose first event is in slice I of the data
+and writes its locations into FILE.I. The counts of the shards are
+then summed into the full cache.
+
+The progress of a long search can be saved periodically into a
+checkpoint file, from which an interrupted run can be resumed.
+*/
+
+#ifndef LOCATION_CACHE_H
+#define LOCATION_CACHE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <time.h>
+#include <sys/types.h>
+#include "edges.h"
+
+// typed_weights[event_type][e] is the number of events of the given
+// type on the edge with dense id e.
+typedef std::map<short int, std::vector<unsigned int> > TypedEdgeWeights;
+
+struct LocationCacheKey
+{
+  uint64_t events_digest; // Events::digest() of the input events.
+  unsigned int tw;
+  unsigned int max_size;
+  unsigned int time_gap;
+  unsigned int maximal;
+  unsigned int shard;    // Index of the shard, 0 if not sharded.
+  unsigned int n_shards; // Number of shards, 0 if not sharded.
+};
+
+/* The file of shard i of the cache 'fileName'. */
+std::string shard_file_name(const std::string& fileName, unsigned int i);
+
+/* Write the cache. Returns false if the file could not be written. */
+bool write_location_cache(const std::string& fileName,
+			  const LocationCacheKey& key,
+			  const TypedEdgeWeights& typed_weights,
+			  const EdgeVectorMap& locationMap);
+
+/* Read the cache. Returns false if the file does not exist, it cannot
+   be read or its key differs from 'key'; in this case the output is
+   left empty. */
+bool read_location_cache(const std::string& fileName,
+			 const LocationCacheKey& key,
+			 TypedEdgeWeights& typed_weights,
+			 EdgeVectorMap& locationMap);
+
+/* Read the caches of shards 0, ..., key.n_shards-1 written with the
+   same key (apart from the shard index) and sum their location
+   counts. Returns false if any of them cannot be read. */
+bool read_location_cache_shards(const std::string& fileName,
+				const LocationCacheKey& key,
+				TypedEdgeWeights& typed_weights,
+				EdgeVectorMap& locationMap);
+
+/* Class: LocationCheckpoint
+
+   The locations found by a search that has processed the first
+   'done' root events (or maximal subgraphs). The checkpoints are
+   written in the background by a child process, which gets its own
+   copy of the locations, so the search is not stalled.
+*/
+class LocationCheckpoint
+{
+public:
+  /* Checkpoints are written into 'fileName' at most every
+     'interval' seconds. */
+  LocationCheckpoint(const std::string& fileName,
+		     const LocationCacheKey& key,
+		     unsigned int interval);
+
+  /* Waits for the checkpoint being written. */
+  ~LocationCheckpoint();
+
+  /* Read the last checkpoint. Returns false if the file does not
+     exist, it cannot be read or its key differs; in this case
+     'done' is 0 and 'locationMap' is empty. */
+  bool read(unsigned long long& done, EdgeVectorMap& locationMap) const;
+
+  /* Start writing a checkpoint if 'interval' seconds have passed
+     since the last one. This is called after each root event, so the
+     time is checked only every CLOCK_CHECK_INTERVAL calls. */
+  void update(unsigned long long done, const EdgeVectorMap& locationMap);
+
+  /* Write the checkpoint of a finished search. Returns false if the
+     file could not be written. */
+  bool finish(unsigned long long done, const EdgeVectorMap& locationMap);
+
+private:
+  static const unsigned int CLOCK_CHECK_INTERVAL = 1024;
+
+  bool write(unsigned long long done, const EdgeVectorMap& locationMap) const;
+  void wait_writer();
+
+  std::string fileName;
+  LocationCacheKey key;
+  unsigned int interval;
+  time_t last_write;
+  unsigned int n_updates; // Calls of update() since the clock was read.
+  pid_t writer; // The process writing a checkpoint, 0 if none.
+};
+
+#endif
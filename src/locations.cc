@@ -0,0 +1,302 @@
+#include <fstream>
+#include "locations.h"
+#include "serialize.h"
+#include "rng.h"
+
+// File identifiers and format versions.
+static const char* STATE_TAG = "TMFSTATE";
+static const char* REFS_TAG = "TMFREFS ";
+static const unsigned int FILE_VERSION = 1;
+static const unsigned int REFS_VERSION = 2;
+
+LocationRecord::LocationRecord(unsigned int motif_hash, unsigned int typed_hash, bin_id bin):
+  motif_hash(motif_hash),
+  typed_hash(typed_hash),
+  bin(bin)
+{}
+
+void sample_references(const LocationRecords& records,
+		       WeightsMap& weightsMap,
+		       ReferenceMotifCounter<double>& motif_counts,
+		       unsigned int N_ref,
+		       uint32_t seed,
+		       unsigned int first_ref)
+{
+  if (N_ref == 0) return;
+
+  std::vector<double> u(N_ref);
+  std::vector<unsigned int> ref_counts(N_ref);
+  for (unsigned int k = 0; k < records.size(); k++)
+    {
+      // Get a random number of this motif given the edge weights at
+      // this location for each reference. The random number of
+      // reference r at record k is fixed by the seed, so references
+      // can be created in any order or in separate runs.
+      wBinner& binner = weightsMap[records[k].motif_hash];
+      unsigned int val;
+      if (binner.is_constant(records[k].bin, val))
+	{
+	  if (val == 0) continue;
+	  std::fill(ref_counts.begin(), ref_counts.end(), val);
+	}
+      else
+	{
+	  random_uniforms(seed, RNG_REFERENCES, k, first_ref, N_ref, &u[0]);
+	  binner.get_random(records[k].bin, u, ref_counts);
+	}
+
+      // Add counts to the reference value of the typed motif (if
+      // non-zero).
+      unsigned int i_ref = 1;
+      for (std::vector<unsigned int>::const_iterator ref_it = ref_counts.begin();
+	   ref_it != ref_counts.end(); ++ref_it)
+	{
+	  if (*ref_it) motif_counts.add_at(records[k].typed_hash, i_ref, *ref_it);
+	  ++i_ref;
+	}
+    }
+}
+
+unsigned int sample_reference_stats(const LocationRecords& records,
+				    WeightsMap& weightsMap,
+				    ReferenceMotifCounter<double>& motif_counts,
+				    unsigned int N_ref,
+				    uint32_t seed,
+				    double tolerance,
+				    unsigned int min_count,
+				    unsigned int batch)
+{
+  if (N_ref == 0) return 0;
+
+  // Give each typed motif a dense id. Records whose distribution has
+  // a single value contribute the same count to every reference;
+  // their sum is calculated once, and only the remaining records
+  // are kept with their motif id and binner.
+  std::map<unsigned int, unsigned int> motif_ids;
+  std::vector<unsigned int> hashes;
+  std::vector<unsigned int> const_counts, const_locs;
+  std::vector<unsigned int> record_index, record_motif;
+  std::vector<wBinner*> record_binner;
+  for (unsigned int k = 0; k < records.size(); k++)
+    {
+      std::map<unsigned int, unsigned int>::iterator id_it = motif_ids.find(records[k].typed_hash);
+      if (id_it == motif_ids.end())
+	{
+	  id_it = motif_ids.insert(std::make_pair(records[k].typed_hash, (unsigned int)hashes.size())).first;
+	  hashes.push_back(records[k].typed_hash);
+	  const_counts.push_back(0);
+	  const_locs.push_back(0);
+	}
+      wBinner* binner = &weightsMap[records[k].motif_hash];
+      unsigned int val;
+      if (binner->is_constant(records[k].bin, val))
+	{
+	  if (val)
+	    {
+	      const_counts[id_it->second] += val;
+	      const_locs[id_it->second]++;
+	    }
+	}
+      else
+	{
+	  record_index.push_back(k);
+	  record_motif.push_back(id_it->second);
+	  record_binner.push_back(binner);
+	}
+    }
+
+  const unsigned int n_motifs = hashes.size();
+  std::vector<unsigned int> data_counts(n_motifs);
+  for (unsigned int id = 0; id < n_motifs; id++) data_counts[id] = motif_counts.get_count(hashes[id]);
+
+  // The references are created in pairs, since a single random
+  // block gives the numbers of both references at each record.
+  std::vector<ReferenceStats> stats(n_motifs);
+  std::vector<unsigned int> counts[2], n_locs[2];
+  double u[2];
+  unsigned int i_ref = 0;
+  bool converged = false;
+  while (i_ref < N_ref && !converged)
+    {
+      const unsigned int n_pair = std::min(2u, N_ref - i_ref);
+      for (unsigned int p = 0; p < n_pair; p++)
+	{
+	  counts[p] = const_counts;
+	  n_locs[p] = const_locs;
+	}
+      for (unsigned int j = 0; j < record_index.size(); j++)
+	{
+	  const unsigned int k = record_index[j];
+	  random_uniforms(seed, RNG_REFERENCES, k, i_ref, n_pair, u);
+	  for (unsigned int p = 0; p < n_pair; p++)
+	    {
+	      unsigned int val = record_binner[j]->get_random(records[k].bin, u[p]);
+	      if (val)
+		{
+		  counts[p][record_motif[j]] += val;
+		  n_locs[p][record_motif[j]]++;
+		}
+	    }
+	}
+      for (unsigned int p = 0; p < n_pair && !converged; p++)
+	{
+	  for (unsigned int id = 0; id < n_motifs; id++)
+	    {
+	      stats[id].add(counts[p][id], n_locs[p][id], data_counts[id]);
+	    }
+	  i_ref++;
+
+	  // Check convergence after each batch.
+	  if (tolerance > 0 && batch && i_ref % batch == 0)
+	    {
+	      double max_error = 0;
+	      for (unsigned int id = 0; id < n_motifs; id++)
+		{
+		  if (data_counts[id] >= min_count)
+		    max_error = std::max(max_error, stats[id].z_error(data_counts[id]));
+		}
+	      std::cout << "   " << i_ref << " references, largest z-score error " << max_error << "\n";
+	      converged = (max_error <= tolerance);
+	    }
+	}
+    }
+
+  for (unsigned int id = 0; id < n_motifs; id++)
+    {
+      motif_counts.set_reference_stats(hashes[id], stats[id]);
+    }
+  return i_ref;
+}
+
+void add_reference_moments(const LocationRecords& records,
+			   WeightsMap& weightsMap,
+			   ReferenceMotifCounter<double>& motif_counts)
+{
+  double mean, var, p_nonzero;
+  for (LocationRecords::const_iterator r_it = records.begin(); r_it != records.end(); ++r_it)
+    {
+      weightsMap[r_it->motif_hash].get_moments(r_it->bin, mean, var, p_nonzero);
+      motif_counts.add_moments(r_it->typed_hash, mean, var, p_nonzero);
+    }
+}
+
+bool write_state(const std::string& fileName,
+		 const std::set<limit_type>& limits,
+		 const WeightsMap& weightsMap,
+		 const LocationRecords& records,
+		 const ReferenceMotifCounter<double>& motif_counts)
+{
+  std::ofstream os(fileName.c_str(), std::ios::binary);
+  if (os.fail()) return false;
+  write_header(os, STATE_TAG, FILE_VERSION);
+
+  std::vector<limit_type> limit_vec(limits.begin(), limits.end());
+  write_vector(os, limit_vec);
+  write_value(os, (unsigned int)weightsMap.size());
+  for (WeightsMap::const_iterator w_it = weightsMap.begin(); w_it != weightsMap.end(); ++w_it)
+    {
+      write_value(os, w_it->first);
+      w_it->second.write(os);
+    }
+  write_vector(os, records);
+  motif_counts.write(os, false);
+
+  os.close();
+  return !os.fail();
+}
+
+bool read_state(const std::string& fileName,
+		BinIndex& bin_index,
+		WeightsMap& weightsMap,
+		LocationRecords& records,
+		ReferenceMotifCounter<double>& motif_counts)
+{
+  std::ifstream is(fileName.c_str(), std::ios::binary);
+  if (is.fail() || !read_header(is, STATE_TAG, FILE_VERSION)) return false;
+
+  std::vector<limit_type> limit_vec;
+  if (!read_vector(is, limit_vec)) return false;
+  if (!bin_index.Init(std::set<limit_type>(limit_vec.begin(), limit_vec.end()))) return false;
+
+  unsigned int n_binners, hash;
+  if (!read_value(is, n_binners)) return false;
+  for (unsigned int i = 0; i < n_binners; i++)
+    {
+      if (!read_value(is, hash) || !weightsMap[hash].read(is, bin_index)) return false;
+    }
+  if (!read_vector(is, records)) return false;
+  if (!motif_counts.read(is, 0, true)) return false;
+
+  // Every record must refer to a bin of a saved binner and to a
+  // saved motif.
+  for (LocationRecords::const_iterator r_it = records.begin(); r_it != records.end(); ++r_it)
+    {
+      WeightsMap::const_iterator w_it = weightsMap.find(r_it->motif_hash);
+      if (w_it == weightsMap.end() || r_it->bin >= w_it->second.size()) return false;
+      if (!motif_counts.has_motif(r_it->typed_hash)) return false;
+    }
+  return true;
+}
+
+bool get_state_digest(const std::string& fileName, uint64_t& digest)
+{
+  std::ifstream is(fileName.c_str(), std::ios::binary);
+  if (is.fail()) return false;
+  const uint64_t FNV_prime = 1099511628211ULL;
+  digest = 14695981039346656037ULL;
+  std::vector<char> buf(READ_CHUNK);
+  while (is)
+    {
+      is.read(&buf[0], buf.size());
+      for (std::streamsize i = 0; i < is.gcount(); i++)
+	{
+	  digest ^= (unsigned char)buf[i];
+	  digest *= FNV_prime;
+	}
+    }
+  return is.eof();
+}
+
+static void write_reference_info(std::ostream& os, const ReferenceFileInfo& info)
+{
+  write_value(os, info.state_digest);
+  write_value(os, info.seed);
+  write_value(os, info.first_ref);
+  write_value(os, info.N_ref);
+}
+
+static bool read_reference_info(std::istream& is, ReferenceFileInfo& info)
+{
+  return (read_header(is, REFS_TAG, REFS_VERSION) && read_value(is, info.state_digest) &&
+	  read_value(is, info.seed) && read_value(is, info.first_ref) &&
+	  read_value(is, info.N_ref));
+}
+
+bool write_references(const std::string& fileName,
+		      const ReferenceFileInfo& info,
+		      const ReferenceMotifCounter<double>& motif_counts)
+{
+  std::ofstream os(fileName.c_str(), std::ios::binary);
+  if (os.fail()) return false;
+  write_header(os, REFS_TAG, REFS_VERSION);
+  write_reference_info(os, info);
+  motif_counts.write(os, true);
+  os.close();
+  return !os.fail();
+}
+
+bool read_reference_info(const std::string& fileName, ReferenceFileInfo& info)
+{
+  std::ifstream is(fileName.c_str(), std::ios::binary);
+  return !is.fail() && read_reference_info(is, info);
+}
+
+bool read_references(const std::string& fileName,
+		     ReferenceMotifCounter<double>& motif_counts,
+		     unsigned int offset)
+{
+  std::ifstream is(fileName.c_str(), std::ios::binary);
+  ReferenceFileInfo info;
+  if (is.fail() || !read_reference_info(is, info)) return false;
+  return motif_counts.read(is, offset, false);
+}
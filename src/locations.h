@@ -0,0 +1,138 @@
+/*
+Compact records of the locations in the aggregate network.
+
+During the pass over all locations we save for each location the
+information needed to sample the reference counts: the hash of the
+motif that defines the reference distribution, the hash of the typed
+motif and the weight bin of the location. The references can then be
+created with a linear scan over the records without constructing the
+motifs again.
+*/
+
+#ifndef LOCATIONS_H
+#define LOCATIONS_H
+
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include "binner.h"
+#include "motif_counter.h"
+
+// weightsMap[motif_hash].add(weightVector, value)
+// weightsMap[motif_hash].get_mean(weightVector, result)
+typedef Binner<unsigned int> wBinner;
+typedef std::vector<unsigned int> WeightVector;
+typedef std::map<unsigned int, wBinner> WeightsMap;
+
+struct LocationRecord
+{
+  unsigned int motif_hash; // Key of the binner in weightsMap.
+  unsigned int typed_hash; // Hash of the typed motif at this location.
+  bin_id bin;              // Weight bin of this location in the binner.
+  LocationRecord() {};
+  LocationRecord(unsigned int motif_hash, unsigned int typed_hash, bin_id bin);
+};
+typedef std::vector<LocationRecord> LocationRecords;
+
+/* Go through all location records and add a random count at each
+   location to the references 1, ..., N_ref of motif_counts. All
+   typed motifs in the records must already have been added to
+   motif_counts.
+
+   The random numbers of reference r are those of reference
+   first_ref + r - 1 of the given seed, so references created in
+   separate runs with the same seed are identical to those of a
+   single run.
+ */
+void sample_references(const LocationRecords& records,
+		       WeightsMap& weightsMap,
+		       ReferenceMotifCounter<double>& motif_counts,
+		       unsigned int N_ref,
+		       uint32_t seed,
+		       unsigned int first_ref = 0);
+
+/* Create N_ref references like sample_references(), but one
+   reference at a time: after going through all records, the counts
+   of the reference are added to the running statistics of each
+   motif. The counts of individual references are not saved, so
+   memory use does not depend on N_ref. motif_counts should be
+   created with N_ref = 0.
+
+   If tolerance > 0, N_ref is the maximum number of references. After
+   every 'batch' references the creation is stopped if the z-score of
+   every motif with empirical count at least 'min_count' is known to
+   within +-tolerance, or relative accuracy 'tolerance' if |z| > 1
+   (95% confidence interval).
+
+   Returns the number of references created.
+ */
+unsigned int sample_reference_stats(const LocationRecords& records,
+				    WeightsMap& weightsMap,
+				    ReferenceMotifCounter<double>& motif_counts,
+				    unsigned int N_ref,
+				    uint32_t seed,
+				    double tolerance = 0,
+				    unsigned int min_count = 0,
+				    unsigned int batch = 100);
+
+/* Go through all location records and add the exact moments of the
+   count distribution at each location to the reference moments of
+   motif_counts. No random values are drawn.
+ */
+void add_reference_moments(const LocationRecords& records,
+			   WeightsMap& weightsMap,
+			   ReferenceMotifCounter<double>& motif_counts);
+
+/* Save everything needed for creating references into a binary
+   file: the weight bin limits, the binners, the location records and
+   the empirical motif counts. 
+ */
+bool write_state(const std::string& fileName,
+		 const std::set<limit_type>& limits,
+		 const WeightsMap& weightsMap,
+		 const LocationRecords& records,
+		 const ReferenceMotifCounter<double>& motif_counts);
+
+/* Read a file written by write_state(). The binners in weightsMap
+   use bin_index, which is initialized with the saved limits. The
+   empirical counts are added to motif_counts.
+ */
+bool read_state(const std::string& fileName,
+		BinIndex& bin_index,
+		WeightsMap& weightsMap,
+		LocationRecords& records,
+		ReferenceMotifCounter<double>& motif_counts);
+
+/* The origin of the references in a reference file: the digest of
+   the state file they were created from, the seed, and the indices
+   first_ref, ..., first_ref + N_ref - 1 of the references. */
+struct ReferenceFileInfo
+{
+  uint64_t state_digest;
+  uint32_t seed;
+  unsigned int first_ref;
+  unsigned int N_ref;
+};
+
+/* Calculate a digest of the contents of a state file. Returns false
+   if the file cannot be read. */
+bool get_state_digest(const std::string& fileName, uint64_t& digest);
+
+/* Save the reference counts of motif_counts into a binary file. */
+bool write_references(const std::string& fileName,
+		      const ReferenceFileInfo& info,
+		      const ReferenceMotifCounter<double>& motif_counts);
+
+/* Read the origin of the references in a file written by
+   write_references(). */
+bool read_reference_info(const std::string& fileName, ReferenceFileInfo& info);
+
+/* Add the references in a file written by write_references() to
+   motif_counts, starting after reference 'offset'.
+ */
+bool read_references(const std::string& fileName,
+		     ReferenceMotifCounter<double>& motif_counts,
+		     unsigned int offset);
+
+#endif
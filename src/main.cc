@@ -20,6 +20,7 @@ along with this program.  If not, see {http://www.gnu.org/licenses/}.
 #include <math.h>
 #include <time.h>
 #include <iterator>
+#include <algorithm>
 #include "events.h"
 #include "tsubgraph.h"
 #include "subnets.h"
@@ -29,20 +30,15 @@ along with this program.  If not, see {http://www.gnu.org/licenses/}.
 #include "lcelib/Nets.H"
 #include "edges.h"
 #include "bin_limits.h"
+#include "locations.h"
+#include "location_cache.h"
 
 // LocationMap[motif_hash][edge_id_list] = count
 
-// weightsMap[motif_hash].add(weightVector, value)
-// weightsMap[motif_hash].get_mean(weightVector, result)
-typedef Binner<unsigned int> wBinner;
-typedef std::vector<unsigned int> WeightVector;
-typedef std::map<unsigned int, wBinner> WeightsMap;
-
 typedef DirNet<unsigned int> NetType;
 
 typedef std::vector<short int> TypeSeq;
 typedef std::vector<TypeSeq> TypeSeqs;
-typedef std::map<unsigned int, TypeSeqs> TypeSeqsMap;
 
 // Get current date/time, format is YYYY-MM-DD.HH:mm:ss
 const std::string currentDateTime() {
@@ -78,15 +74,17 @@ unsigned int get_location_count(const EdgeVectorMap& locationMap,
 }
 
 bool get_edge_weights(const EdgeVector& edges,
-		      const std::map<short int, NetType*>& nets,
+		      const Events& events,
+		      const TypedEdgeWeights& typed_weights,
 		      std::vector<unsigned int>& weights)
 {
   weights.clear();
   for (EdgeVector::const_iterator ev_it = edges.begin();
        ev_it != edges.end(); ++ev_it) 
     {
-      const NetType& net = *(nets.find(ev_it->type)->second);
-      unsigned int w = net[ev_it->from][ev_it->to];
+      edge_id e = events.find_edge(ev_it->from, ev_it->to);
+      if (e == Event::null_event) return false;
+      unsigned int w = typed_weights.find(ev_it->type)->second[e];
       if (w == 0) return false;
       weights.push_back(w);
     }
@@ -121,43 +119,67 @@ unsigned int read_node_types(std::vector<unsigned short int>& node_types, std::s
   return node_count;
 }
 
-bool fill_event_type_seq(TypeSeqsMap& ets, unsigned int n_max, const std::set<short int>& eventTypes, bool multiple_event_types)
+/* Fill 'ets' with the assignments of event types on the edges in
+   'nodePairs'. Only types that actually occur on each edge are used:
+   'type_masks[i][j]' has bit k set if there is an event of type
+   'event_types[k]' on the edge from i to j. If multiple_event_types
+   is false, only assignments where all edges have the same type are
+   included. The assignments are listed in the same order as when
+   going through all combinations, the type of the first edge
+   changing fastest. Returns the number of assignments.
+ */
+unsigned int fill_event_type_seqs(TypeSeqs& ets,
+				  const NodepairVector& nodePairs,
+				  const NetType& type_masks,
+				  const std::vector<short int>& event_types,
+				  bool multiple_event_types)
 {
-  if (multiple_event_types)
+  ets.clear();
+  unsigned int n = nodePairs.size();
+
+  if (!multiple_event_types)
     {
-      // Initialize with an empty vector.
-      TypeSeq c0;
-      ets[0].push_back(c0);
+      // Only types that occur on every edge are possible.
+      unsigned int mask = ~0u;
+      for (unsigned int i = 0; i < n && mask; ++i)
+	mask &= type_masks[nodePairs[i].first][nodePairs[i].second];
+      for (unsigned int k = 0; k < event_types.size(); ++k)
+	{
+	  if (mask & (1u << k)) ets.push_back(TypeSeq(n, event_types[k]));
+	}
+      return ets.size();
+    }
 
-      for (unsigned int n = 1; n <= n_max; ++n) {
-	for (std::set<short int>::const_iterator et_it = eventTypes.begin();
-	     et_it != eventTypes.end(); ++et_it)
-	  {
-	    for (TypeSeqs::const_iterator cp_it = ets[n-1].begin();
-		 cp_it != ets[n-1].end(); ++cp_it)
-	      {
-		// Combine the previous combination and the event type.
-		TypeSeq cn(cp_it->begin(), cp_it->end());
-		cn.push_back(*et_it);
-		// Add to map.
-		ets[n].push_back(cn);
-	      }
-	  }
-      }
+  // Collect the types that occur on each edge. If some edge has none,
+  // there are no valid assignments.
+  std::vector<std::vector<short int> > edge_types(n);
+  for (unsigned int i = 0; i < n; ++i)
+    {
+      unsigned int mask = type_masks[nodePairs[i].first][nodePairs[i].second];
+      for (unsigned int k = 0; k < event_types.size(); ++k)
+	{
+	  if (mask & (1u << k)) edge_types[i].push_back(event_types[k]);
+	}
+      if (edge_types[i].empty()) return 0;
     }
-  else //Only single event type in a motif.
+
+  // Go through all combinations like an odometer.
+  std::vector<unsigned int> pos(n, 0);
+  TypeSeq seq(n);
+  while (true)
     {
-      for (std::set<short int>::const_iterator et_it = eventTypes.begin();
-	   et_it != eventTypes.end(); ++et_it)
-        {
-	  for (unsigned int n = 1; n <= n_max; ++n)
-            {
-	      TypeSeq c(n,*et_it);
-	      ets[n].push_back(c);
-            }
-        }
+      for (unsigned int i = 0; i < n; ++i) seq[i] = edge_types[i][pos[i]];
+      ets.push_back(seq);
+
+      unsigned int i = 0;
+      for (; i < n; ++i)
+	{
+	  if (++pos[i] < edge_types[i].size()) break;
+	  pos[i] = 0;
+	}
+      if (i == n) break;
     }
-  return true;
+  return ets.size();
 }
 
 
@@ -199,7 +221,8 @@ private:
 	      << "   ./tmf TW OUTPUTNAME < EVENTFILE\n\n"
 	      << "The input event data has one event per line, with the first four columns corresponding to\n"
 	      << "starting time, duration, and the id's of the two nodes involved. A fifth column may also be\n"
-	      << "used to denote event type by an integer. When omitted, the type is assumed to be 1.\n\n"
+	      << "used to denote event type by an integer. When omitted, the type is assumed to be 1.\n"
+	      << "At most 32 different event types can be used.\n\n"
 	      << "There are two required parameters:\n\n"
 	      << "  TW is the time window.\n\n"
 	      << "  OUTPUTNAME is the beginning of the output file name.\n\n"
@@ -213,6 +236,80 @@ private:
 	      << "-r INT | --references INT\n"
 	      << "  The number of independent references to create. The references are created by generating\n"
 	      << "  random motif counts at each location.\n\n"
+	      << "--analytic\n"
+	      << "  Calculate the mean and standard deviation of the reference counts exactly from the count\n"
+	      << "  distributions at each location instead of from the random references. This affects the\n"
+	      << "  columns ref_avg, ratio, ref_std, z-score and N_loc_ref. The references given by '-r' are\n"
+	      << "  still created for N_ref and N_lt_ref, but a small number is then enough.\n\n"
+	      << "--quantiles LIST\n"
+	      << "  Also print the given quantiles of the reference counts, for example '5,50,95'. The\n"
+	      << "  values are percentages, separated by commas. Each quantile is printed in column 'qX'\n"
+	      << "  before the motif, where X is the percentage.\n\n"
+	      << "--binary_output\n"
+	      << "  Write the results into OUTPUT.bin in a binary format instead of the text file\n"
+	      << "  OUTPUT.dat. The file has the same columns, each stored as a contiguous array, and can\n"
+	      << "  be read with python/result_file.py.\n\n"
+	      << "--motif_structure\n"
+	      << "  Also print the structure of each motif, which does not depend on the types: the number\n"
+	      << "  of nodes, events and distinct edges (direction ignored), a hash of the underlying\n"
+	      << "  undirected graph, and the events in temporal order as 'i>j' with the nodes labelled\n"
+	      << "  in the order they first appear. These are printed before the motif.\n\n"
+	      << "--coarse_counts\n"
+	      << "  Also write the counts of untyped motifs (no node or event types) into OUTPUT_untyped.dat\n"
+	      << "  and of static motifs (no types and no order of events) into OUTPUT_static.dat. The counts\n"
+	      << "  and references are sums over the typed motifs. Cannot be used with '--streaming'.\n\n"
+	      << "--streaming\n"
+	      << "  Create the references one at a time and save only the statistics needed for the\n"
+	      << "  output instead of the motif counts in each reference. This reduces memory use when\n"
+	      << "  there are many references. Cannot be used with '--quantiles'.\n\n"
+	      << "--adaptive FLOAT\n"
+	      << "  Create references in batches until the z-score of each motif is known to within +-FLOAT\n"
+	      << "  (95% confidence interval; relative accuracy FLOAT if |z| > 1), or until the number of\n"
+	      << "  references given by '-r' is reached. A motif with the same count in every reference\n"
+	      << "  is converged only after 300 references.\n"
+	      << "  The number of references used is reported in the log. Implies '--streaming'.\n\n"
+	      << "--adaptive_min_count INT\n"
+	      << "  With '--adaptive', only require convergence for motifs that occur at least INT times in\n"
+	      << "  the data (default 10).\n\n"
+	      << "--adaptive_batch INT\n"
+	      << "  With '--adaptive', check convergence after every INT references (default 100).\n\n"
+	      << "--ensemble INT\n"
+	      << "  Use INT time-shuffled versions of the data as the references instead of random counts\n"
+	      << "  at each location. The events are read only once; each member is shuffled from a copy\n"
+	      << "  of the original events and the members are processed in parallel threads. '-st -2' or\n"
+	      << "  a value of '-st' larger than 1 selects the shuffling, but the data itself is not shuffled.\n"
+	      << "  Member 0 is the data shuffled by '-st' with the same seed. Cannot be used with '-r'.\n"
+	      << "  With '-st 0' the members are instead INT permutations of the node types, which are all\n"
+	      << "  counted during the single pass over the locations. With '-st -1' they are INT shuffles\n"
+	      << "  of the edge types, counted by relabelling the locations found in the data.\n\n"
+	      << "--save_state STR\n"
+	      << "  Save the weight distributions and location records into file STR. More references can\n"
+	      << "  then be created from the file with 'tmf-sample' and combined with 'tmf-merge' without\n"
+	      << "  going through the data again.\n\n"
+	      << "--location_cache STR\n"
+	      << "  Save the motif counts at each location and the aggregate network into file STR, or read\n"
+	      << "  them from STR if it was created from the same events with the same time window, '-m',\n"
+	      << "  '--maximal' and '-t'. The motif search is then skipped, so runs that differ only in node\n"
+	      << "  types or in '-st 0' can reuse the file. Cannot be used if the data is shuffled with\n"
+	      << "  '-st' other than 0 (except with '--ensemble').\n\n"
+	      << "--shard INT/INT\n"
+	      << "  With '--shard I/N', find only the motifs whose first event is in the I:th of N time\n"
+	      << "  slices of the data (I = 0, ..., N-1), write their locations into STR.I, where STR is\n"
+	      << "  given with '--location_cache', and exit. The shards can be run in parallel.\n\n"
+	      << "--shards INT\n"
+	      << "  Read the locations written by shards 0, ..., INT-1 with '--shard' and save them into\n"
+	      << "  the location cache instead of finding the motifs. The results are identical to a run\n"
+	      << "  without shards.\n\n"
+	      << "--checkpoint STR\n"
+	      << "  Save the progress of the motif search and the locations found so far into file STR\n"
+	      << "  every hour (see '--checkpoint_interval'), and when the search is finished. The file is\n"
+	      << "  written in the background while the search continues.\n\n"
+	      << "--checkpoint_interval INT\n"
+	      << "  The number of seconds between checkpoints. Defaults to 3600.\n\n"
+	      << "--resume\n"
+	      << "  Continue the motif search from the checkpoint given with '--checkpoint', if it was\n"
+	      << "  saved by a run with the same data and parameters. The results are identical to an\n"
+	      << "  uninterrupted run.\n\n"
 	      << "-nf STR | --node_file STR\n"
 	      << "  The file that contains the node types. It has one line per node, giving the node id\n"
 	      << "  and type (both integers) separated by whitespace. The nodes that are not listed are\n"
@@ -224,14 +321,22 @@ private:
 	      << "  The fraction of largest weights to exclude from the analysis. The purpose of excluding\n"
 	      << "  largest weights is to reduce the possible bias caused by the very largest weight.\n"
 	      << "  A value of 0.001 or below is typically good.\n\n"
+	      << "--bin_min_count INT\n"
+	      << "  Bin edge weights so that each bin contains at least INT edges of the aggregate network.\n"
+	      << "  By default every distinct weight has its own bin. Coarser bins use less memory and make\n"
+	      << "  the reference distributions less exact.\n\n"
+	      << "--bin_number INT\n"
+	      << "  Bin edge weights into at most INT bins with approximately equal number of edges in each.\n"
+	      << "  Cannot be used together with '--bin_min_count'.\n\n"
 	      << "--allow_multiple_event_types\n"
 	      << "  By default only those motifs are detected where all events have the same type. If this\n"
-	      << "  parameter is given, also includes motifs that have multiple event types. If this argument\n"
-	      << "  is not used the run time increases by factor `N` compared to having only single event type\n"
-	      << "  (here `N` is the number of event types). When this argument is given, the increase is\n"
-	      << "  approximately `N^m` where `m` is the maximum number of events in a motif.\n\n"
+	      << "  parameter is given, also includes motifs that have multiple event types. Only the event\n"
+	      << "  types that occur on each edge of the aggregate network are tried, so the run time depends\n"
+	      << "  on how many types the edges have. In the worst case (every type on every edge) the run\n"
+	      << "  time increases by factor `N^m` compared to having only single event type, where `N` is\n"
+	      << "  the number of event types and `m` is the maximum number of events in a motif.\n\n"
 	      << "-h INT | --hypothesis INT\n"
-	      << "  The null hypothesis to test. There are three possible values:\n"
+	      << "  The null hypothesis to test. There are three possible values, or 'all':\n"
 	      << "     0 : Motif count does not depend on node types. (default)\n"
 	      << "     1 : Motif count does not depend on event types.\n"
 	      << "     2 : Motif count does not depend on node or event types.\n"
@@ -240,7 +345,9 @@ private:
 	      << "  for '1' after excluding event types, and for '2' after excluding both. Note that if the\n"
 	      << "  data does not contain multiple event types, '0' and '2' give identical result and\n"
 	      << "  '1' is non-sensical; if there is only one node type, '1' and '2' are identical and using \n"
-	      << "  '0' makes no sense.\n\n"
+	      << "  '0' makes no sense. With 'all' the three hypotheses are tested with a single pass over\n"
+	      << "  the data and the results are written into files OUTPUT_h0.dat, OUTPUT_h1.dat and\n"
+	      << "  OUTPUT_h2.dat. Cannot be used with '--ensemble' or '--save_state'.\n\n"
 	      << "-t INT | --time_gap INT\n"
 	      << "  The time gap to leave in the beginning and end of the data: only those subgraphs\n"
 	      << "  will be used that contain at least one event in the valid region. The purpose is to\n"
@@ -248,10 +355,21 @@ private:
 	      << "  default value is no gap.\n\n"
 	      << "-st INT | --shuffle_type INT\n"
 	      << "  If given, shuffled data is used instead of empirical one. The value is either\n"
+	      << "      -2 : shuffle event times (random permutation; events of a node may overlap)\n"
 	      << "      -1 : shuffle edge types\n"
 	      << "       0 : shuffle node types\n"
 	      << "       1 : shuffle event times (uniform)\n"
 	      << "      >1 : shuffle event times (with bias corresponding to value)\n\n"
+	      << "--shuffle_batch INT\n"
+	      << "  Number of candidate switches drawn at a time when shuffling event times without\n"
+	      << "  bias. Candidates with no common nodes are switched in parallel; the result does\n"
+	      << "  not depend on the number of threads (OMP_NUM_THREADS). 1 gives the serial\n"
+	      << "  algorithm. The default is 0, i.e. the number of nodes / 64.\n\n"
+	      << "--shuffle_target FLOAT\n"
+	      << "  Stop shuffling event times without bias before 10 x N_events switches once at most the\n"
+	      << "  fraction FLOAT of events has never been switched and the mean log inter-event time of\n"
+	      << "  nodes has stopped changing (relative change at most FLOAT). The mixing achieved is\n"
+	      << "  always reported in the log. The default 0 always makes 10 x N_events switches.\n\n"
 	      << "-s INT | --seed INT\n"
 	      << "  The seed for the random number generator. If omitted the system time is used.\n"
 	      << "\n"
@@ -291,6 +409,94 @@ private:
 	i++; if (i > argc) return false;
 	references = atoi(argv[i]);
       }
+    else if (name.compare("--analytic") == 0)
+      {
+	analytic = true;
+      }
+    else if (name.compare("--quantiles") == 0)
+      {
+	i++; if (i > argc) return false;
+	if (!parse_quantiles(argv[i], quantiles)) return false;
+      }
+    else if (name.compare("--ensemble") == 0)
+      {
+	i++; if (i > argc) return false;
+	ensemble = atoi(argv[i]);
+      }
+    else if (name.compare("--coarse_counts") == 0)
+      {
+	coarse_counts = true;
+      }
+    else if (name.compare("--binary_output") == 0)
+      {
+	binary_output = true;
+      }
+    else if (name.compare("--motif_structure") == 0)
+      {
+	motif_structure = true;
+      }
+    else if (name.compare("--streaming") == 0)
+      {
+	streaming = true;
+      }
+    else if (name.compare("--adaptive") == 0)
+      {
+	i++; if (i > argc) return false;
+	if (atof(argv[i]) <= 0) return false;
+	tolerance = atof(argv[i]);
+	streaming = true;
+      }
+    else if (name.compare("--adaptive_min_count") == 0)
+      {
+	i++; if (i > argc) return false;
+	adaptive_min_count = atoi(argv[i]);
+      }
+    else if (name.compare("--adaptive_batch") == 0)
+      {
+	i++; if (i > argc) return false;
+	if (atoi(argv[i]) <= 0) return false;
+	adaptive_batch = atoi(argv[i]);
+      }
+    else if (name.compare("--save_state") == 0)
+      {
+	i++; if (i > argc) return false;
+	state_file_name = argv[i];
+      }
+    else if (name.compare("--location_cache") == 0)
+      {
+	i++; if (i > argc) return false;
+	cache_file_name = argv[i];
+      }
+    else if (name.compare("--shard") == 0)
+      {
+	i++; if (i > argc) return false;
+	std::string value(argv[i]);
+	size_t pos = value.find('/');
+	if (pos == std::string::npos) return false;
+	shard = atoi(value.substr(0, pos).c_str());
+	n_shards = atoi(value.substr(pos + 1).c_str());
+	if (n_shards == 0 || shard >= n_shards) return false;
+      }
+    else if (name.compare("--checkpoint") == 0)
+      {
+	i++; if (i > argc) return false;
+	checkpoint_file_name = argv[i];
+      }
+    else if (name.compare("--checkpoint_interval") == 0)
+      {
+	i++; if (i > argc) return false;
+	checkpoint_interval = atoi(argv[i]);
+      }
+    else if (name.compare("--resume") == 0)
+      {
+	resume = true;
+      }
+    else if (name.compare("--shards") == 0)
+      {
+	i++; if (i > argc) return false;
+	merge_shards = atoi(argv[i]);
+	if (merge_shards == 0) return false;
+      }
     else if ((name.compare("-nf") == 0) || (name.compare("--node_file") == 0))
       {
 	i++; if (i > argc) return false;
@@ -307,6 +513,18 @@ private:
 	i++; if (i > argc) return false;
 	weight_omit = atof(argv[i]);
       } 
+    else if (name.compare("--bin_min_count") == 0)
+      {
+	i++; if (i > argc) return false;
+	if (atoi(argv[i]) <= 0 || bin_number) return false;
+	bin_min_count = atoi(argv[i]);
+      } 
+    else if (name.compare("--bin_number") == 0)
+      {
+	i++; if (i > argc) return false;
+	if (atoi(argv[i]) <= 0 || bin_min_count) return false;
+	bin_number = atoi(argv[i]);
+      } 
     else if (name.compare("--allow_multiple_event_types") == 0)
       {
 	allow_multiple_event_types = true;
@@ -314,14 +532,19 @@ private:
     else if ((name.compare("-h") == 0) || (name.compare("--hypothesis") == 0))
       {
 	i++; if (i > argc) return false;
-	hypothesis = atoi(argv[i]);
-	if ((hypothesis < 0) || (hypothesis > 2)) return false;
+	if (std::string(argv[i]).compare("all") == 0) all_hypotheses = true;
+	else
+	  {
+	    hypothesis = atoi(argv[i]);
+	    if ((hypothesis < 0) || (hypothesis > 2)) return false;
+	  }
       }
     else if ((name.compare("-st") == 0) || (name.compare("--shuffle_type") == 0))
       {
 	i++; if (i > argc) return false;
 	int val = atoi(argv[i]);
-	if (val == -1) edge_type_shuffling = true;
+	if (val == -2) time_permutation = true;
+	else if (val == -1) edge_type_shuffling = true;
 	else if (val == 0) node_type_shuffling = true;
 	else if (val >= 1) {
 	  time_shuffling = true;
@@ -329,6 +552,17 @@ private:
 	}
 	else return false;
       }
+    else if (name.compare("--shuffle_batch") == 0)
+      {
+	i++; if (i > argc) return false;
+	shuffle_batch = atoi(argv[i]);
+      }
+    else if (name.compare("--shuffle_target") == 0)
+      {
+	i++; if (i > argc) return false;
+	shuffle_target = atof(argv[i]);
+	if (shuffle_target < 0 || shuffle_target >= 1) return false;
+      }
     else if ((name.compare("-s") == 0) || (name.compare("--seed") == 0))
       {
 	i++; if (i > argc) return false;
@@ -344,22 +578,96 @@ private:
 
   bool post_process()
   {
+    // Quantiles require the counts of each reference.
+    if (!quantiles.empty() && (streaming || (references == 0 && ensemble == 0)))
+      {
+	std::cerr << "Error: '--quantiles' requires references and cannot be used with '--streaming'.\n";
+	return false;
+      }
+
+    // The ensemble members replace the sampled references.
+    if (ensemble && (references || analytic || streaming || !state_file_name.empty()))
+      {
+	std::cerr << "Error: '--ensemble' cannot be used with '-r', '--analytic', '--streaming', '--adaptive' or '--save_state'.\n";
+	return false;
+      }
+
+    // An ensemble uses one kind of shuffling.
+    if (ensemble && (node_type_shuffling + edge_type_shuffling + (time_shuffling || time_permutation) > 1))
+      {
+	std::cerr << "Error: With '--ensemble', give only one value of '-st'.\n";
+	return false;
+      }
+
+    // The coarser counts are sums over the references.
+    if (coarse_counts && streaming)
+      {
+	std::cerr << "Error: '--coarse_counts' cannot be used with '--streaming' or '--adaptive'.\n";
+	return false;
+      }
+
+    // The ensemble and the saved state are for a single hypothesis.
+    if (all_hypotheses && (ensemble || !state_file_name.empty()))
+      {
+	std::cerr << "Error: '--hypothesis all' cannot be used with '--ensemble' or '--save_state'.\n";
+	return false;
+      }
+
+    // The cached locations are valid only for the data as read.
+    if (!cache_file_name.empty() && (time_shuffling || time_permutation || edge_type_shuffling) && !ensemble)
+      {
+	std::cerr << "Error: '--location_cache' cannot be used when event times or edge types are shuffled.\n";
+	return false;
+      }
+
+    // The shards are written into and read from the location cache.
+    if ((n_shards || merge_shards) && cache_file_name.empty())
+      {
+	std::cerr << "Error: '--shard' and '--shards' require '--location_cache'.\n";
+	return false;
+      }
+    if (n_shards && merge_shards)
+      {
+	std::cerr << "Error: '--shard' and '--shards' cannot be used together.\n";
+	return false;
+      }
+    if (resume && checkpoint_file_name.empty())
+      {
+	std::cerr << "Error: '--resume' requires '--checkpoint'.\n";
+	return false;
+      }
+
     if (verbose) 
       {
 	std::cout << "Input parameters read (" << currentDateTime() << "):\n";
 	std::cout << "   Time window : " << tw << std::endl;
 	std::cout << "   Skipping " << time_gap << " time units.\n";
 	if (weight_omit > 0.0) std::cout << "   Omitting highest " << weight_omit << " of edge weights." << std::endl;
+	if (bin_min_count) std::cout << "   Binning edge weights with at least " << bin_min_count << " edges per bin.\n";
+	if (bin_number) std::cout << "   Binning edge weights into at most " << bin_number << " bins.\n";
       }
 
     // Construct file names. The value of max_size determines
     // whether only maximal motifs are detected or all motifs up to a
     // given size.
-    output_file_name = output_file_trunk + ".dat";
+    if (all_hypotheses)
+      {
+	for (unsigned int h = 0; h < 3; ++h)
+	  {
+	    hypotheses.push_back(h);
+	    output_file_names.push_back(output_file_trunk + "_h" + std::string(1, '0' + h) + (binary_output ? ".bin" : ".dat"));
+	  }
+      }
+    else
+      {
+	hypotheses.push_back(hypothesis);
+	output_file_names.push_back(output_file_trunk + (binary_output ? ".bin" : ".dat"));
+      }
 
     if (verbose) 
       {
-	std::cout << "   Output file: " << output_file_name << std::endl;
+	for (unsigned int k = 0; k < output_file_names.size(); ++k)
+	  std::cout << "   Output file: " << output_file_names[k] << std::endl;
 	if (maximal)
 	  {
 	    if (max_size) std::cout << "   Finding maximal motifs with up to " << max_size << " events.\n";
@@ -382,24 +690,44 @@ private:
 	  }
 
 	if (references) std::cout << "   Creating "<<references<<" references (seed " << rng_seed << ")\n";
+	else if (ensemble && node_type_shuffling) std::cout << "   Creating " << ensemble << " node-type permuted references (seed " << rng_seed << ")\n";
+	else if (ensemble && edge_type_shuffling) std::cout << "   Creating " << ensemble << " edge-type shuffled references (seed " << rng_seed << ")\n";
+	else if (ensemble) std::cout << "   Creating " << ensemble << " time-shuffled references (seed " << rng_seed << ")\n";
 	else std::cout << "   No references.\n";
+	if (analytic) std::cout << "   Calculating reference mean and standard deviation exactly.\n";
+	if (!quantiles.empty()) std::cout << "   Printing quantiles " << quantiles << " of the reference counts.\n";
+	if (streaming) std::cout << "   Saving only the statistics of the references.\n";
+	if (coarse_counts) std::cout << "   Writing also the counts of untyped and static motifs.\n";
+	if (motif_structure) std::cout << "   Printing the structure of each motif.\n";
+	if (tolerance > 0) std::cout << "   Stopping when z-scores of motifs with count >= " << adaptive_min_count
+				     << " are within +-" << tolerance << " (checked every " << adaptive_batch << " references).\n";
+	if (!state_file_name.empty()) std::cout << "   Saving state into '" << state_file_name << "'.\n";
+	if (!cache_file_name.empty()) std::cout << "   Using location cache '" << cache_file_name << "'.\n";
+	if (n_shards) std::cout << "   Finding the locations of shard " << shard << "/" << n_shards << ".\n";
+	if (merge_shards) std::cout << "   Combining the locations of " << merge_shards << " shards.\n";
+	if (!checkpoint_file_name.empty()) std::cout << "   " << (resume ? "Resuming from" : "Saving")
+						     << " checkpoints in '" << checkpoint_file_name << "'.\n";
 
 	if (allow_multiple_event_types) std::cout << "   Multiple event type motifs included (assuming there are multiple event types).\n";
 	else std::cout << "   Including only motifs with single event type.\n";
 
-	if (hypothesis == 0) std::cout << "   H_0 : Motif count does not depend on node types.\n";
-	else if (hypothesis == 1) std::cout << "   H_0 : Motif count does not depend on event types.\n";
-	else std::cout << "   H_0 : Motif count does not depend on node or event types.\n";
+	for (unsigned int k = 0; k < hypotheses.size(); ++k)
+	  {
+	    if (hypotheses[k] == 0) std::cout << "   H_0 : Motif count does not depend on node types.\n";
+	    else if (hypotheses[k] == 1) std::cout << "   H_0 : Motif count does not depend on event types.\n";
+	    else std::cout << "   H_0 : Motif count does not depend on node or event types.\n";
+	  }
       }
 
     // Print the value of the rng seed.
-    if (verbose && time_shuffling) 
+    if (verbose && time_shuffling && !ensemble) 
       {
 	std::cout << "   Shuffling event times (seed " << rng_seed << ")\n";
 	if (bias_strength > 1) std::cout << "      Shuffling with bias strength " << bias_strength << ".\n";
       }
-    if (verbose && edge_type_shuffling) std::cout << "   Shuffling edge types (seed " << rng_seed << ")\n";
-    if (verbose && node_type_shuffling) std::cout << "   Shuffling node types (seed " << rng_seed << ")\n";
+    if (verbose && time_permutation && !ensemble) std::cout << "   Permuting event times (seed " << rng_seed << ")\n";
+    if (verbose && edge_type_shuffling && !ensemble) std::cout << "   Shuffling edge types (seed " << rng_seed << ")\n";
+    if (verbose && node_type_shuffling && !ensemble) std::cout << "   Shuffling node types (seed " << rng_seed << ")\n";
 
     return true;
   };
@@ -409,20 +737,46 @@ public:
   unsigned int tw;
   std::string output_file_trunk;
 
-  // Parameters constructed from the required parameters.
-  std::string output_file_name;
+  // Parameters constructed from the required parameters. The output
+  // file output_file_names[k] is for null hypothesis hypotheses[k].
+  std::vector<unsigned int> hypotheses;
+  std::vector<std::string> output_file_names;
 
   // Optional parameters.
   unsigned int max_size;
   bool maximal;
   unsigned int references;
+  bool analytic;
+  std::vector<double> quantiles;
+  bool streaming;
+  bool coarse_counts;
+  bool binary_output;
+  bool motif_structure;
+  unsigned int ensemble;
+  double tolerance;
+  unsigned int adaptive_min_count;
+  unsigned int adaptive_batch;
+  std::string state_file_name;
+  std::string cache_file_name;
+  unsigned int shard;
+  unsigned int n_shards;
+  unsigned int merge_shards;
+  std::string checkpoint_file_name;
+  unsigned int checkpoint_interval;
+  bool resume;
   std::string node_file_name;
   unsigned int time_gap;
   double weight_omit;
+  unsigned int bin_min_count;
+  unsigned int bin_number;
   bool allow_multiple_event_types;
   unsigned int hypothesis;
+  bool all_hypotheses;
   bool time_shuffling;
+  bool time_permutation;
   unsigned int bias_strength;
+  unsigned int shuffle_batch;
+  double shuffle_target;
   bool edge_type_shuffling;
   bool node_type_shuffling;
   unsigned int rng_seed;
@@ -433,13 +787,37 @@ public:
     max_size(0),
     maximal(false),
     references(0),
+    analytic(false),
+    quantiles(),
+    streaming(false),
+    coarse_counts(false),
+    binary_output(false),
+    motif_structure(false),
+    ensemble(0),
+    tolerance(0),
+    adaptive_min_count(10),
+    adaptive_batch(100),
+    state_file_name(),
+    cache_file_name(),
+    shard(0),
+    n_shards(0),
+    merge_shards(0),
+    checkpoint_file_name(),
+    checkpoint_interval(3600),
+    resume(false),
     node_file_name(),
     time_gap(0),
     weight_omit(0.0),
+    bin_min_count(0),
+    bin_number(0),
     allow_multiple_event_types(false),
     hypothesis(0),
+    all_hypotheses(false),
     time_shuffling(false),
+    time_permutation(false),
     bias_strength(1),
+    shuffle_batch(0),
+    shuffle_target(0),
     edge_type_shuffling(false),
     node_type_shuffling(false),
     rng_seed(time(NULL)) 
@@ -479,24 +857,55 @@ public:
 };
 
 
-/* Get all motifs and use them to fill locationMap.
+/* Find the events [first, end) that are used as the first event of
+   subgraphs: those outside the time gaps, or with '--shard I/N' the
+   I:th of N consecutive slices with equal numbers of these events.
+   Every subgraph is found only from its first event, so the shards
+   together find each subgraph exactly once.
  */
-bool get_motifs(EdgeVectorMap& locationMap, 
-		const Events& events,
-		const Parameters& param,
-		std::vector<unsigned short int> const& node_types)
+void get_root_events(const Events& events,
+		     const Parameters& param,
+		     event_id& first, event_id& end)
 {
   unsigned int gap_0 = events.first_time() + param.time_gap;
   unsigned int gap_1 = events.last_start_time() - param.time_gap;
 
-  ProgressCounter evCounter(std::cerr, events.size(), 10);
+  first = end = 0;
   for (Events::const_iterator e_it = events.begin(); e_it != events.end(); ++e_it)
     {
-      // Run through the first time_gap events and break if
-      // the last time gap has been reached.
       if (e_it->start_time() < gap_0) continue;
       if (e_it->start_time() > gap_1) break;
+      if (end == 0) first = e_it->id();
+      end = e_it->id() + 1;
+    }
+  if (param.n_shards)
+    {
+      unsigned long long n = end - first;
+      end = first + n*(param.shard + 1)/param.n_shards;
+      first = first + n*param.shard/param.n_shards;
+    }
+}
+
+/* Get all motifs and use them to fill locationMap. The search
+   starts after the first 'done' root events, whose motifs are
+   already in locationMap, and saves its progress into 'checkpoint'
+   if one is given. Progress is printed to 'output'.
+ */
+bool get_motifs(EdgeVectorMap& locationMap, 
+		const Events& events,
+		const Parameters& param,
+		std::vector<unsigned short int> const& node_types,
+		LocationCheckpoint* checkpoint = NULL,
+		unsigned long long done = 0,
+		std::ostream& output = std::cerr)
+{
+  event_id first, end;
+  get_root_events(events, param, first, end);
+  if (done > end - first) return false;
 
+  ProgressCounter evCounter(output, end - first - done, 10);
+  for (Events::const_iterator e_it = events.begin() + first + done; e_it != events.begin() + end; ++e_it)
+    {
       // Print progress.
       evCounter.next(*e_it);
 
@@ -509,16 +918,23 @@ bool get_motifs(EdgeVectorMap& locationMap,
 	  const TSubgraph& sg = **sit;
 	  if (sg.is_valid()) update_location_count(sg, locationMap);
 	}
+      if (checkpoint) checkpoint->update(e_it->id() + 1 - first, locationMap);
     }
+  if (checkpoint && !checkpoint->finish(end - first, locationMap)) return false;
   return true;
 }
 
-/* Get maximal motifs and use them to fill locationMap.
+/* Get maximal motifs and use them to fill locationMap. The first
+   'done' maximal subgraphs have already been counted and are
+   skipped. Progress is printed to 'output'.
  */
 bool get_maximal_motifs(EdgeVectorMap& locationMap, 
 			const Events& events,
 			const Parameters& param,
-			std::vector<unsigned short int> const& node_types)
+			std::vector<unsigned short int> const& node_types,
+			LocationCheckpoint* checkpoint = NULL,
+			unsigned long long done = 0,
+			std::ostream& output = std::cerr)
 {
   unsigned int gap_0 = events.first_time() + param.time_gap;
   unsigned int gap_1 = events.last_start_time() - param.time_gap;
@@ -527,7 +943,9 @@ bool get_maximal_motifs(EdgeVectorMap& locationMap,
   // so that we get the set of events that correspond to each maximal
   // subgraph id.
   std::map<event_id, EventSet> maximal_subgraphs;
-  ProgressCounter evCounter(std::cerr, events.size(), 10);
+  event_id first, end;
+  get_root_events(events, param, first, end);
+  ProgressCounter evCounter(output, events.size(), 10);
   for (Events::const_iterator e_it = events.begin(); e_it != events.end(); ++e_it)
     {
       // Run through the first time_gap events and break if
@@ -545,18 +963,367 @@ bool get_maximal_motifs(EdgeVectorMap& locationMap,
   // Now we know the exact set of events in each maximal
   // subgraph, so we just need to construct the corresponding
   // motifs.
-  std::map<event_id, EventSet>::const_iterator ms_it;
-  for (ms_it = maximal_subgraphs.begin(); ms_it != maximal_subgraphs.end(); ms_it++)
+  if (done > maximal_subgraphs.size()) return false;
+  std::map<event_id, EventSet>::const_iterator ms_it = maximal_subgraphs.begin();
+  std::advance(ms_it, done);
+  for (; ms_it != maximal_subgraphs.end(); ms_it++, done++)
     {
-      // Skip maximal subgraphs that are too large.
+      if (checkpoint) checkpoint->update(done, locationMap);
+
+      // Skip maximal subgraphs that are too large, and those of
+      // other shards.
       if (param.max_size && ms_it->second.size() > param.max_size) continue;
+      if (*ms_it->second.begin() < first || *ms_it->second.begin() >= end) continue;
       // Create temporal sugraph and update the location count.
       TSubgraph sg(events, ms_it->second, node_types, param.tw);
       if (sg.is_valid()) update_location_count(sg, locationMap);
     }
+  if (checkpoint && !checkpoint->finish(done, locationMap)) return false;
   return true;
 }
 
+/* Create param.ensemble time-shuffled versions of the events and add
+   the motif counts of member m to reference m+1 of motif_counts.
+   Each member starts from a copy of 'pristine', so the events are
+   not read again, and the members are processed in parallel. Only
+   the locations in 'location_index' (edges -> index in 'records')
+   are counted; because time shuffling does not change the aggregate
+   network, these are the same locations as in the data. The members
+   print no progress of their own; one line is printed as each
+   member is finished.
+ */
+void add_ensemble_references(const Events& pristine,
+			     const Parameters& param,
+			     std::vector<unsigned short int> const& node_types,
+			     unsigned int N_shuffle,
+			     const EdgeVectorMap& location_index,
+			     const LocationRecords& records,
+			     ReferenceMotifCounter<double>& motif_counts)
+{
+  const int N_members = param.ensemble;
+  int N_done = 0;
+#pragma omp parallel
+  {
+    Events member(pristine);
+    // A stream without a buffer discards everything written into it.
+    std::ostream quiet(NULL);
+#pragma omp for schedule(dynamic, 1)
+    for (int m = 0; m < N_members; ++m)
+      {
+	// Restore the original events and shuffle them. Member m uses
+	// stream m of the time shuffling, so member 0 is the same as
+	// the data shuffled with '-st'.
+	member = pristine;
+	RandomStream rng(param.rng_seed, RNG_TIME_SHUFFLE, m);
+	if (param.time_permutation) member.shuffle(rng);
+	else if (param.bias_strength > 1) member.shuffle_constrained_corr(N_shuffle, param.bias_strength, rng, quiet);
+	else member.shuffle_constrained(N_shuffle, rng, param.shuffle_batch, param.shuffle_target, quiet);
+	member.find_maximal_subgraphs(param.tw);
+
+	EdgeVectorMap member_map;
+	if (param.maximal) get_maximal_motifs(member_map, member, param, node_types, NULL, 0, quiet);
+	else get_motifs(member_map, member, param, node_types, NULL, 0, quiet);
+
+	std::vector<std::pair<unsigned int, unsigned int> > member_counts;
+	for (EdgeVectorMap::const_iterator ev_it = member_map.begin(); ev_it != member_map.end(); ++ev_it)
+	  {
+	    EdgeVectorMap::const_iterator li_it = location_index.find(ev_it->first);
+	    if (li_it != location_index.end()) member_counts.push_back(std::make_pair(li_it->second, ev_it->second));
+	  }
+#pragma omp critical
+	{
+	  for (unsigned int k = 0; k < member_counts.size(); ++k)
+	    {
+	      motif_counts.add_at(records[member_counts[k].first].typed_hash, m + 1, member_counts[k].second);
+	    }
+	  std::cerr << "   Reference " << m + 1 << " finished (" << ++N_done << "/" << N_members
+		    << ", " << member_map.size() << " locations).\n";
+	}
+      }
+  }
+}
+
+/* The untyped and static motifs of each typed motif that has been
+   counted, by hash. The coarser motifs depend only on the edges of a
+   location and their order, so they are found once for each typed
+   motif, and a typed motif found by changing only the types of a
+   location has the same coarser motifs as the original one. The
+   structure of a typed motif is that of its untyped motif.
+ */
+struct CoarseMotifs
+{
+  std::map<unsigned int, unsigned int> untyped_hash; // Typed hash -> untyped hash.
+  std::map<unsigned int, unsigned int> static_hash;  // Typed hash -> static hash.
+  std::map<unsigned int, std::string> untyped_desc;
+  std::map<unsigned int, std::string> static_desc;
+  std::map<unsigned int, MotifStructure> untyped_structure;
+
+  bool contains(unsigned int typed_hash) const
+  {
+    return untyped_hash.find(typed_hash) != untyped_hash.end();
+  };
+
+  void add(unsigned int typed_hash, Motif* motif_untyped, Motif* motif_static)
+  {
+    untyped_hash[typed_hash] = motif_untyped->get_hash();
+    static_hash[typed_hash] = motif_static->get_hash();
+    if (untyped_structure.find(motif_untyped->get_hash()) == untyped_structure.end())
+      untyped_structure[motif_untyped->get_hash()] = motif_untyped->get_structure();
+    untyped_desc[motif_untyped->get_hash()] = to_string(*motif_untyped);
+    static_desc[motif_static->get_hash()] = to_string(*motif_static);
+  };
+
+  void add_same(unsigned int typed_hash, unsigned int known_typed_hash)
+  {
+    untyped_hash[typed_hash] = untyped_hash[known_typed_hash];
+    static_hash[typed_hash] = static_hash[known_typed_hash];
+  };
+};
+
+/* Add the count of the typed motif at the location given by 'edges'
+   to reference m+1 of motif_counts for each member m of a node-type
+   ensemble. Only the node types differ between the members, so the
+   typed motif depends only on the tuple of types of the nodes at the
+   location, and each distinct tuple is canonicalized once. The tuple
+   of the data ('node_types', with typed motif 'data_hash') is known
+   in advance. If 'coarse' is not NULL, the coarser motifs of new
+   typed motifs are added to it.
+ */
+void add_node_type_ensemble_counts(const EdgeVector& edges,
+				   unsigned int location_count,
+				   const std::vector<unsigned short int>& node_types,
+				   unsigned int data_hash,
+				   const std::vector<std::vector<unsigned short int> >& permuted_types,
+				   ReferenceMotifCounter<double>& motif_counts,
+				   CoarseMotifs* coarse)
+{
+  if (location_count == 0) return;
+
+  // The distinct nodes at the location.
+  std::vector<node_id> nodes;
+  for (EdgeVector::const_iterator e_it = edges.begin(); e_it != edges.end(); ++e_it)
+    {
+      if (std::find(nodes.begin(), nodes.end(), e_it->from) == nodes.end()) nodes.push_back(e_it->from);
+      if (std::find(nodes.begin(), nodes.end(), e_it->to) == nodes.end()) nodes.push_back(e_it->to);
+    }
+
+  typedef std::map<std::vector<unsigned short int>, unsigned int> TypeTupleCache;
+  TypeTupleCache typed_hashes;
+  std::vector<unsigned short int> tuple(nodes.size());
+  for (unsigned int j = 0; j < nodes.size(); ++j) tuple[j] = node_types[nodes[j]];
+  typed_hashes[tuple] = data_hash;
+
+  for (unsigned int m = 0; m < permuted_types.size(); ++m)
+    {
+      for (unsigned int j = 0; j < nodes.size(); ++j) tuple[j] = permuted_types[m][nodes[j]];
+      TypeTupleCache::const_iterator th_it = typed_hashes.find(tuple);
+      if (th_it != typed_hashes.end())
+	{
+	  motif_counts.add_at(th_it->second, m + 1, location_count);
+	}
+      else
+	{
+	  TSubgraph sg(edges, permuted_types[m]);
+	  Motif* motif_typed = sg.get_typed_motif();
+	  motif_counts.add_at(motif_typed, m + 1, location_count);
+	  typed_hashes[tuple] = motif_typed->get_hash();
+	  if (coarse && !coarse->contains(motif_typed->get_hash())) coarse->add_same(motif_typed->get_hash(), data_hash);
+	}
+    }
+}
+
+/* A location counted for an edge-type ensemble: the dense ids of its
+   edges and the number of motifs at it in the data. */
+struct EdgeTypeLocation
+{
+  std::vector<edge_id> edges;
+  unsigned int count;
+};
+
+/* Add the motif counts of each member m of an edge-type ensemble to
+   reference m+1 of motif_counts. Shuffling the edge types keeps all
+   events of each edge, so the motifs of a member are those of the
+   data with the types of the edges relabelled by member_types[m];
+   the motifs do not need to be found again. As with the data, the
+   locations with multiple event types are skipped unless
+   'allow_multiple' is true. At each location every distinct tuple of
+   edge types is canonicalized once. The locations are processed in
+   blocks: the motifs of a block are found in parallel, and then
+   added to motif_counts in order. If 'coarse' is not NULL, the
+   coarser motifs of new typed motifs are added to it.
+ */
+void add_edge_type_ensemble_references(const std::vector<EdgeTypeLocation>& locations,
+				       const Events& events,
+				       std::vector<unsigned short int> const& node_types,
+				       const std::vector<std::vector<short int> >& member_types,
+				       bool allow_multiple,
+				       ReferenceMotifCounter<double>& motif_counts,
+				       CoarseMotifs* coarse)
+{
+  const unsigned int N_members = member_types.size();
+  const size_t block_size = 1024;
+
+  // tuple_ids[i][m] is the index in motifs[i] of the motif of member
+  // m at location i of the block, or -1 if the location is skipped.
+  std::vector<std::vector<int> > tuple_ids(block_size);
+  std::vector<std::vector<Motif*> > motifs(block_size);
+
+  // The untyped and static motifs of location i of the block.
+  std::vector<Motif*> untyped_motifs(block_size, NULL), static_motifs(block_size, NULL);
+  for (size_t first = 0; first < locations.size(); first += block_size)
+    {
+      const int N_block = std::min(block_size, locations.size() - first);
+#pragma omp parallel for schedule(dynamic, 16)
+      for (int i = 0; i < N_block; ++i)
+	{
+	  const std::vector<edge_id>& loc_edges = locations[first + i].edges;
+	  std::map<std::vector<short int>, int> tuples;
+	  std::vector<short int> tuple(loc_edges.size());
+	  tuple_ids[i].assign(N_members, -1);
+	  for (unsigned int m = 0; m < N_members; ++m)
+	    {
+	      bool single_type = true;
+	      for (unsigned int k = 0; k < loc_edges.size(); ++k)
+		{
+		  tuple[k] = member_types[m][loc_edges[k]];
+		  if (tuple[k] != tuple[0]) single_type = false;
+		}
+	      if (!single_type && !allow_multiple) continue;
+
+	      std::map<std::vector<short int>, int>::const_iterator t_it = tuples.find(tuple);
+	      if (t_it == tuples.end())
+		{
+		  EdgeVector edges;
+		  for (unsigned int k = 0; k < loc_edges.size(); ++k)
+		    edges.push_back(Edge(events.edge_source(loc_edges[k]), events.edge_target(loc_edges[k]), tuple[k]));
+		  TSubgraph sg(edges, node_types);
+		  t_it = tuples.insert(std::make_pair(tuple, (int)motifs[i].size())).first;
+		  motifs[i].push_back(sg.get_motif(true, true, false));
+		}
+	      tuple_ids[i][m] = t_it->second;
+	    }
+
+	  if (coarse && !motifs[i].empty())
+	    {
+	      EdgeVector edges;
+	      for (unsigned int k = 0; k < loc_edges.size(); ++k)
+		edges.push_back(Edge(events.edge_source(loc_edges[k]), events.edge_target(loc_edges[k]), 1));
+	      TSubgraph sg(edges, node_types);
+	      untyped_motifs[i] = sg.get_motif(false, false, false);
+	      static_motifs[i] = sg.get_motif(false, false, true);
+	    }
+	}
+
+      for (int i = 0; i < N_block; ++i)
+	{
+	  unsigned int count = locations[first + i].count;
+	  for (unsigned int m = 0; m < N_members; ++m)
+	    {
+	      if (tuple_ids[i][m] >= 0) motif_counts.add_at(motifs[i][tuple_ids[i][m]], m + 1, count);
+	    }
+	  for (unsigned int k = 0; k < motifs[i].size(); ++k)
+	    {
+	      if (coarse && !coarse->contains(motifs[i][k]->get_hash()))
+		coarse->add(motifs[i][k]->get_hash(), untyped_motifs[i], static_motifs[i]);
+	      delete motifs[i][k];
+	    }
+	  motifs[i].clear();
+	  delete untyped_motifs[i];
+	  delete static_motifs[i];
+	  untyped_motifs[i] = static_motifs[i] = NULL;
+	}
+    }
+}
+
+/* Write the results in the text or the binary format. */
+bool write_results(const ReferenceMotifCounter<double>& motif_counts,
+		   const std::string& file_name, bool binary)
+{
+  if (binary) return motif_counts.write_binary(file_name);
+  return motif_counts.print(file_name);
+}
+
+/* The motifs of one location with and without node and event types.
+   If all nodes at the location have type 0, the motif with node types
+   is the same as without them, and similarly if all events have type
+   1. Each distinct motif is therefore canonicalized only once. The
+   motifs are owned by this object.
+ */
+class LocationMotifs
+{
+ private:
+  const TSubgraph& sg;
+  bool has_node_types;
+  bool has_event_types;
+  Motif* motifs[4]; // Indexed by 2*use_node_types + use_event_types.
+  Motif* motif_static;
+
+ public:
+  LocationMotifs(const TSubgraph& sg, const EdgeVector& edges,
+		 std::vector<unsigned short int> const& node_types):
+    sg(sg), has_node_types(false), has_event_types(false), motif_static(NULL)
+  {
+    for (unsigned int i = 0; i < 4; ++i) motifs[i] = NULL;
+    for (EdgeVector::const_iterator e_it = edges.begin(); e_it != edges.end(); ++e_it)
+      {
+	if (node_types[e_it->from] || node_types[e_it->to]) has_node_types = true;
+	if (e_it->type != 1) has_event_types = true;
+      }
+  };
+
+  ~LocationMotifs()
+  {
+    for (unsigned int i = 0; i < 4; ++i) delete motifs[i];
+    delete motif_static;
+  };
+
+  Motif* get(bool use_node_types, bool use_event_types)
+  {
+    use_node_types = use_node_types && has_node_types;
+    use_event_types = use_event_types && has_event_types;
+    Motif*& motif = motifs[2*use_node_types + use_event_types];
+    if (motif == NULL) motif = sg.get_motif(use_node_types, use_event_types, false);
+    return motif;
+  };
+
+  Motif* get_static()
+  {
+    if (motif_static == NULL) motif_static = sg.get_motif(false, false, true);
+    return motif_static;
+  };
+};
+
+/* The weight distributions, location records and motif counts of one
+   null hypothesis. The motif that defines the reference distribution
+   omits node types (hypothesis 0), event types (1) or both (2).
+ */
+struct HypothesisCounts
+{
+  bool use_node_types;
+  bool use_event_types;
+  std::string output_file_name;
+
+  // weightsMap[untyped_hash] is a binner instance.
+  WeightsMap weightsMap;
+
+  // Records of the locations included in the statistics. These are
+  // used for sampling the reference counts.
+  LocationRecords locationRecords;
+
+  // Counts of motifs, both empirical and expected. The empirical
+  // counts are at position 0, the references at positions 1 to N_ref.
+  ReferenceMotifCounter<double> motif_counts;
+
+  HypothesisCounts(unsigned int hypothesis, const std::string& output_file_name, unsigned int N_ref):
+    use_node_types(hypothesis == 1),
+    use_event_types(hypothesis == 0),
+    output_file_name(output_file_name),
+    weightsMap(),
+    locationRecords(),
+    motif_counts(N_ref)
+  {};
+};
+
 int main(int argc, char *argv[])
 {
   // Read command line parameters.
@@ -564,9 +1331,6 @@ int main(int argc, char *argv[])
   if (!param.Init(argc, argv)) exit(1);
   std::cout << std::endl;
 
-  // Initialize RNG.
-  srand(param.rng_seed);
-
   // Read in the events.
   std::cerr << "Reading events from stdin ...\n";
   Events events(std::cin);
@@ -594,96 +1358,251 @@ int main(int argc, char *argv[])
     }
   else std::cout << "Only one type (0) of nodes used.\n";
 
-  // Shuffle event times and/or node types.
-  if (param.time_shuffling)
+  // Shuffle event times and/or node types. With an ensemble the
+  // shuffling is done separately for each member.
+  unsigned int shuffle_multiplier = 10;
+  if (param.time_shuffling && !param.ensemble)
     {
-      unsigned int shuffle_multiplier = 10;
       std::cout << "Shuffling (" << shuffle_multiplier << " x N_events";
       if (param.bias_strength > 1) std::cout << " with bias " << param.bias_strength;
+      else if (param.shuffle_target > 0) std::cout << " at most, mixing target " << param.shuffle_target;
       std::cout << ")...\n" << std::flush;
 
-      if (param.bias_strength > 1) events.shuffle_constrained_corr(shuffle_multiplier, param.bias_strength);
-      else events.shuffle_constrained(shuffle_multiplier);
+      RandomStream rng(param.rng_seed, RNG_TIME_SHUFFLE);
+      if (param.bias_strength > 1) events.shuffle_constrained_corr(shuffle_multiplier, param.bias_strength, rng);
+      else events.shuffle_constrained(shuffle_multiplier, rng, param.shuffle_batch, param.shuffle_target);
+    }
+  if (param.time_permutation && !param.ensemble)
+    {
+      std::cout << "Permuting event times...\n" << std::flush;
+      RandomStream rng(param.rng_seed, RNG_TIME_SHUFFLE);
+      events.shuffle(rng);
     }
-  if (param.node_type_shuffling)
+  if (param.node_type_shuffling && !param.ensemble)
     {
-      std::random_shuffle(node_types.begin(), node_types.end());
+      RandomStream rng(param.rng_seed, RNG_NODE_TYPE_SHUFFLE);
+      shuffle_range(node_types.begin(), node_types.end(), rng);
     }
-  if (param.edge_type_shuffling) 
+
+  // Node types of each member of a node-type ensemble. Member m uses
+  // stream m, so member 0 is the same as the data shuffled with
+  // '-st 0'.
+  std::vector<std::vector<unsigned short int> > permuted_types;
+  if (param.ensemble && param.node_type_shuffling)
     {
-      if (!events.shuffle_edge_types())
+      permuted_types.resize(param.ensemble, node_types);
+      for (unsigned int m = 0; m < param.ensemble; ++m)
+	{
+	  RandomStream rng(param.rng_seed, RNG_NODE_TYPE_SHUFFLE, m);
+	  shuffle_range(permuted_types[m].begin(), permuted_types[m].end(), rng);
+	}
+    }
+  if (param.edge_type_shuffling && !param.ensemble) 
+    {
+      RandomStream rng(param.rng_seed, RNG_EDGE_TYPE_SHUFFLE);
+      if (!events.shuffle_edge_types(rng))
         {
 	  std::cerr << "Error: Unable to shuffle edge types because there were multiple event types on some edge.\n";
 	  exit(1);
         }
     }
 
+  // Copy of the events before the maximal subgraphs are found, used
+  // as the starting point of each ensemble member.
+  Events* pristine_events = NULL;
+  if (param.ensemble && !param.node_type_shuffling && !param.edge_type_shuffling) pristine_events = new Events(events);
+
+  // Edge types of the data and of each member of an edge-type
+  // ensemble. Member m uses stream m, so member 0 is the same as the
+  // data shuffled with '-st -1'.
+  std::vector<short int> data_edge_types;
+  std::vector<std::vector<short int> > member_edge_types;
+  if (param.ensemble && param.edge_type_shuffling)
+    {
+      if (!events.get_edge_types(data_edge_types))
+        {
+	  std::cerr << "Error: Unable to shuffle edge types because there were multiple event types on some edge.\n";
+	  exit(1);
+        }
+      member_edge_types.resize(param.ensemble, data_edge_types);
+      for (unsigned int m = 0; m < param.ensemble; ++m)
+	{
+	  RandomStream rng(param.rng_seed, RNG_EDGE_TYPE_SHUFFLE, m);
+	  shuffle_range(member_edge_types[m].begin(), member_edge_types[m].end(), rng);
+	}
+    }
+
   unsigned int gap_0 = events.first_time() + param.time_gap;
   unsigned int gap_1 = events.last_start_time() - param.time_gap;
 
   // EVENT TYPES: Create a set for saving event types in the data.
   std::set<short int> eventTypes;
 
-  // Construct the weighted, directed aggregate network.
+  // Create maps for counting motifs by location.
+  EdgeVectorMap locationMap;
+
+  // Read the typed edge weights and the locations from the cache if
+  // it was created from the same data. Only node types may differ.
+  const unsigned int N_edges = events.get_nof_edges();
+  TypedEdgeWeights typed_weights;
+  LocationCacheKey cache_key;
+  bool cache_read = false;
+  if (!param.cache_file_name.empty() || !param.checkpoint_file_name.empty())
+    {
+      cache_key.events_digest = events.digest();
+      cache_key.tw = param.tw;
+      cache_key.max_size = param.max_size;
+      cache_key.time_gap = param.time_gap;
+      cache_key.maximal = param.maximal;
+      cache_key.shard = param.shard;
+      cache_key.n_shards = param.n_shards;
+    }
+  if (!param.cache_file_name.empty())
+    {
+      if (param.merge_shards)
+	{
+	  cache_key.n_shards = param.merge_shards;
+	  if (!read_location_cache_shards(param.cache_file_name, cache_key, typed_weights, locationMap))
+	    {
+	      std::cerr << "Error: Unable to read the shards of location cache '" << param.cache_file_name
+			<< "' (created from the same data and parameters).\n";
+	      exit(1);
+	    }
+	  std::cout << "Read " << locationMap.size() << " locations from " << param.merge_shards << " shards.\n";
+	  cache_key.n_shards = 0;
+	  std::cout << "Saving locations into cache '" << param.cache_file_name << "'.\n";
+	  if (!write_location_cache(param.cache_file_name, cache_key, typed_weights, locationMap))
+	    std::cerr << "Warning: Unable to write location cache '" << param.cache_file_name << "'.\n";
+	  cache_read = true;
+	}
+      else if (param.n_shards == 0)
+	{
+	  cache_read = read_location_cache(param.cache_file_name, cache_key, typed_weights, locationMap);
+	  if (cache_read) std::cout << "Read " << locationMap.size() << " locations from cache '" << param.cache_file_name << "'.\n";
+	  else std::cout << "No usable location cache in '" << param.cache_file_name << "', finding motifs in data.\n";
+	}
+    }
+
+  // Construct the weighted, directed aggregate network. The weights
+  // are first counted by the dense edge ids of the events, so each
+  // node pair is inserted into the network only once.
   std::cerr << "Constructing aggregate network.\n";
   std::cout << "Constructing aggregate network ("<< currentDateTime() <<").\n";
-  NetType net;
-  std::map<short int, NetType*> nets;
-  for (Events::iterator e_it = events.begin(); e_it != events.end(); ++e_it)
+  std::vector<unsigned int>* curr_typed_weights = NULL;
+  short int curr_type = 0;
+  for (Events::iterator e_it = events.begin(); !cache_read && e_it != events.end(); ++e_it)
     {
       // Run through the first time_gap events and break if
       // the last time gap has been reached.
       if (e_it->start_time() < gap_0) continue;
       if (e_it->start_time() > gap_1) break;
 
-      // Print progress.
-      //evCounter.next(*e_it);
-      net[e_it->from()][e_it->to()] += 1;
-
-      // Update the set of event types.
-      eventTypes.insert(e_it->type());
-
-      // Increase count at the typed network.
-      std::map<short int, NetType*>::iterator m_it = nets.find(e_it->type());
-      if (m_it == nets.end()) 
-        {
-	  nets[e_it->type()] = new NetType;
-	  m_it = nets.find(e_it->type());
-        }
-      NetType& typed_net = *(m_it->second);
-      typed_net[e_it->from()][e_it->to()] += 1;
+      // Increase count at the typed weights.
+      if (curr_typed_weights == NULL || e_it->type() != curr_type)
+	{
+	  curr_type = e_it->type();
+	  curr_typed_weights = &typed_weights[curr_type];
+	  if (curr_typed_weights->empty()) curr_typed_weights->resize(N_edges, 0);
+	}
+      (*curr_typed_weights)[events.edge(e_it->id())]++;
     }
 
-  // Make all typed nets large enough to contain all nodes.
-  for (std::map<short int, NetType*>::iterator m_it = nets.begin();
-       m_it != nets.end(); ++m_it)
+  // The total weights, and the set of event types.
+  std::vector<unsigned int> edge_weights(N_edges, 0);
+  for (TypedEdgeWeights::const_iterator tw_it = typed_weights.begin(); tw_it != typed_weights.end(); ++tw_it)
     {
-      NetType& typed_net = *(m_it->second);
-      typed_net.resize(net.size());
+      eventTypes.insert(tw_it->first);
+      for (edge_id e = 0; e < N_edges; ++e) edge_weights[e] += tw_it->second[e];
+    }
+  NetType net;
+  for (edge_id e = 0; e < N_edges; ++e)
+    {
+      if (edge_weights[e]) net[events.edge_source(e)][events.edge_target(e)] = edge_weights[e];
     }
 
-  // Find the maximal subgraph ids of each event.
-  // This is needed to properly detect motifs.
-  std::cerr << "Finding maximal subgraphs.\n";
-  std::cout << "Finding maximal subgraphs ("<< currentDateTime() <<").\n"; 
-  events.find_maximal_subgraphs(param.tw);
-
-  // Create maps for counting motifs by location.
-  EdgeVectorMap locationMap;
+  // Construct the network of event types on each edge:
+  // type_masks[i][j] has bit k set if there is at least one event of
+  // type event_types[k] from i to j.
+  if (eventTypes.size() > 8*sizeof(unsigned int))
+    {
+      std::cerr << "Error: At most " << 8*sizeof(unsigned int) << " different event types are supported.\n";
+      exit(1);
+    }
+  std::vector<short int> event_types(eventTypes.begin(), eventTypes.end());
+  NetType type_masks;
+  for (unsigned int k = 0; k < event_types.size(); ++k)
+    {
+      const std::vector<unsigned int>& curr_weights = typed_weights[event_types[k]];
+      for (edge_id e = 0; e < N_edges; ++e)
+	{
+	  if (curr_weights[e]) type_masks[events.edge_source(e)][events.edge_target(e)] |= (1u << k);
+	}
+    }
 
   // ***************************
   // *** FILL IN locationMap ***
   // ***************************
   // Find the number of motifs at each location where there is a motif.
-  if (param.maximal)
+  if (!cache_read)
     {
-      std::cerr << "Finding maximal typed motifs in data.\n";
-      get_maximal_motifs(locationMap, events, param, node_types);      
-    }
-  else
-    {
-      std::cerr << "Finding typed motifs in data.\n";
-      get_motifs(locationMap, events, param, node_types);
+      // Find the maximal subgraph ids of each event.
+      // This is needed to properly detect motifs.
+      std::cerr << "Finding maximal subgraphs.\n";
+      std::cout << "Finding maximal subgraphs ("<< currentDateTime() <<").\n"; 
+      events.find_maximal_subgraphs(param.tw);
+
+      // Continue from the last checkpoint. The count of processed
+      // root events (or maximal subgraphs) is the same in any run with
+      // the same key.
+      LocationCheckpoint* checkpoint = NULL;
+      unsigned long long done = 0;
+      if (!param.checkpoint_file_name.empty())
+	{
+	  checkpoint = new LocationCheckpoint(param.checkpoint_file_name, cache_key, param.checkpoint_interval);
+	  if (param.resume && checkpoint->read(done, locationMap))
+	    std::cout << "Resuming from checkpoint '" << param.checkpoint_file_name << "' (" << done
+		      << (param.maximal ? " maximal subgraphs" : " root events") << " done, "
+		      << locationMap.size() << " locations).\n";
+	  else if (param.resume)
+	    std::cout << "No usable checkpoint in '" << param.checkpoint_file_name << "', starting from the beginning.\n";
+	}
+
+      bool search_ok;
+      if (param.maximal)
+	{
+	  std::cerr << "Finding maximal typed motifs in data.\n";
+	  search_ok = get_maximal_motifs(locationMap, events, param, node_types, checkpoint, done);
+	}
+      else
+	{
+	  std::cerr << "Finding typed motifs in data.\n";
+	  search_ok = get_motifs(locationMap, events, param, node_types, checkpoint, done);
+	}
+      delete checkpoint;
+      if (!search_ok)
+	{
+	  std::cerr << "Error: Checkpoint '" << param.checkpoint_file_name << "' could not be written or does not match the data.\n";
+	  exit(1);
+	}
+
+      if (param.n_shards)
+	{
+	  // A shard only saves its locations.
+	  const std::string shard_file = shard_file_name(param.cache_file_name, param.shard);
+	  std::cout << "Saving the locations of shard " << param.shard << " into '" << shard_file << "'.\n";
+	  if (!write_location_cache(shard_file, cache_key, typed_weights, locationMap))
+	    {
+	      std::cerr << "Error: Unable to write '" << shard_file << "'.\n";
+	      exit(1);
+	    }
+	  return 0;
+	}
+      if (!param.cache_file_name.empty())
+	{
+	  std::cout << "Saving locations into cache '" << param.cache_file_name << "'.\n";
+	  if (!write_location_cache(param.cache_file_name, cache_key, typed_weights, locationMap))
+	    std::cerr << "Warning: Unable to write location cache '" << param.cache_file_name << "'.\n";
+	}
     }
   // Now 'get_location_count(locationMap, edges)' gives the number
   // of motifs at location specified by 'edges'. Note that 'edges'
@@ -696,26 +1615,48 @@ int main(int argc, char *argv[])
 
   // Construct binner limits.
   std::set<unsigned int> bin_limits;
-  get_limits_unbinned(net, bin_limits, param.weight_omit);
+  bool limits_ok;
+  if (param.bin_min_count) limits_ok = get_limits_by_min_count(net, bin_limits, param.bin_min_count, param.weight_omit);
+  else if (param.bin_number) limits_ok = get_limits_by_N_bin(net, bin_limits, param.bin_number, param.weight_omit);
+  else limits_ok = get_limits_unbinned(net, bin_limits, param.weight_omit);
+  if (!limits_ok)
+    {
+      std::cerr << "Error: No edges with events to bin (after omitting the highest weights).\n";
+      exit(1);
+    }
+  std::cout << "   Edge weights divided into " << bin_limits.size() - 1 << " bins.\n";
+  BinIndex bin_index;
+  bin_index.Init(bin_limits);
+
+  // The motif counts of each null hypothesis. With an ensemble there
+  // is only one hypothesis, and the counts of the ensemble members
+  // are added to its references.
+  std::vector<HypothesisCounts*> hypotheses;
+  for (unsigned int k = 0; k < param.hypotheses.size(); ++k)
+    {
+      hypotheses.push_back(new HypothesisCounts(param.hypotheses[k], param.output_file_names[k],
+						param.streaming ? 0 : param.references + param.ensemble));
+      hypotheses.back()->motif_counts.set_quantiles(param.quantiles);
+    }
+  ReferenceMotifCounter<double>& motif_counts = hypotheses[0]->motif_counts;
+  LocationRecords& locationRecords = hypotheses[0]->locationRecords;
 
-  // Object for counting motifs, both empirical and expected. The empirical counts 
-  // should be placed at position 0, the references at position from 1 to param.references.
-  ReferenceMotifCounter<double> motif_counts(param.references);
+  // The coarser motifs of each typed motif, needed for writing the
+  // untyped and static counts and the structure of the motifs.
+  CoarseMotifs coarse_motifs;
+  CoarseMotifs* coarse_ptr = (param.coarse_counts || param.motif_structure ? &coarse_motifs : NULL);
 
-  // Create maps for counting the number of motifs by edge weights.
-  // weightsMap[untyped_hash] is a binner instance.
-  WeightsMap weightsMap;
+  // Index of the location records by edges, needed only for
+  // counting the motifs of ensemble members.
+  EdgeVectorMap locationIndex;
 
-  // Get the event type sequences that we go through next.
-  TypeSeqsMap event_type_seqs;
-  fill_event_type_seq(event_type_seqs, param.max_size, eventTypes, param.allow_multiple_event_types);
-  std::cout << "Combinations of event types to go through per number of events:" << std::endl;
-  std::cout << "   " << event_type_seqs << std::endl;
-
-  // Whether to use node or event types when calculating the hash.
-  bool use_node_types = (param.hypothesis == 1);
-  bool use_event_types = (param.hypothesis == 0);
+  // The locations counted for an edge-type ensemble.
+  std::vector<EdgeTypeLocation> ensemble_locations;
 
+  // The event type sequences are constructed separately for each
+  // location from the types that occur on its edges.
+  TypeSeqs event_type_seqs;
+  std::cout << "Event types in data: " << event_types << std::endl;
 
   // ***************************
   // *** FILL IN weightsMap ***
@@ -733,42 +1674,80 @@ int main(int argc, char *argv[])
 
       const NodepairVector& nodePairs = *sn_it;
 
+      // The members of an edge-type ensemble differ only in the types
+      // of the edges, so their locations are collected once with the
+      // edge ids. The weights do not depend on the types.
+      if (!member_edge_types.empty())
+	{
+	  EdgeTypeLocation loc;
+	  EdgeVector edges;
+	  bool included = true;
+	  for (NodepairVector::const_iterator np_it = nodePairs.begin(); np_it != nodePairs.end(); ++np_it)
+	    {
+	      edge_id e = events.find_edge(np_it->first, np_it->second);
+	      index_type index;
+	      if (!bin_index.get_index(edge_weights[e], index)) included = false;
+	      loc.edges.push_back(e);
+	      edges.push_back(Edge(np_it->first, np_it->second, data_edge_types[e]));
+	    }
+	  loc.count = get_location_count(locationMap, edges);
+	  if (included && loc.count) ensemble_locations.push_back(loc);
+	}
+
       // Iterate through all assignments of event types on these edges.
-      for (TypeSeqs::const_iterator ets_it = event_type_seqs[nodePairs.size()].begin();
-	   ets_it != event_type_seqs[nodePairs.size()].end(); ++ets_it)
+      // Only the types that occur on each edge are used, so every
+      // assignment corresponds to edges with non-zero weight.
+      fill_event_type_seqs(event_type_seqs, nodePairs, type_masks, event_types,
+			   param.allow_multiple_event_types);
+      for (TypeSeqs::const_iterator ets_it = event_type_seqs.begin();
+	   ets_it != event_type_seqs.end(); ++ets_it)
         {
-	  // Get the untyped motif of the temporal subgraph with
-	  // events on the given edges.
 	  EdgeVector edges;
 	  create_edges(edges, nodePairs, *ets_it);
 
-	  TSubgraph sg(edges, node_types);
-	  Motif* motif_untyped = sg.get_motif(use_node_types, use_event_types, false);
-	  unsigned int untyped_hash = motif_untyped->get_hash();
-	  delete motif_untyped;
-
-	  // Get the weight sequence of edges. Continue if some edge
-	  // has zero weight (this is possible because we are
-	  // detecting the subgraphs in a network where all event
-	  // types have been aggregated.
+	  // Get the weight sequence of edges. Because the event types
+	  // were picked from those on each edge, no weight should be
+	  // zero; the check is done before constructing any motifs.
 	  std::vector<unsigned int> curr_weights;
-	  if (!get_edge_weights(edges, nets, curr_weights)) continue;
-
-	  // Get the binner for this motif, and initialize it if one didn't exist.
-	  wBinner& curr_binner = weightsMap[untyped_hash];
-	  if (!curr_binner.is_initialized()) curr_binner.Init(bin_limits, edges.size());
+	  if (!get_edge_weights(edges, events, typed_weights, curr_weights)) continue;
 
-	  // Increase the binner at index given by weights by a value given
-	  // by the number of this motif at this exact location.
+	  // The motifs of the temporal subgraph with events on the
+	  // given edges.
+	  TSubgraph sg(edges, node_types);
+	  LocationMotifs location_motifs(sg, edges, node_types);
 	  unsigned int location_count = get_location_count(locationMap, edges);
-	  if (curr_binner.add(curr_weights, location_count))
-            {
-	      // The count at this location was successfully added, which means that 
-	      // the weights at this location are included in statistics. Increase the
-	      // count of the typed motif also.
-	      Motif* motif_typed = sg.get_typed_motif();
-	      motif_counts.add_at(motif_typed, 0, location_count);
-            }
+
+	  for (unsigned int k = 0; k < hypotheses.size(); ++k)
+	    {
+	      HypothesisCounts& hc = *hypotheses[k];
+
+	      // Get the untyped motif of this hypothesis.
+	      unsigned int untyped_hash = location_motifs.get(hc.use_node_types, hc.use_event_types)->get_hash();
+
+	      // Get the binner for this motif, and initialize it if one didn't exist.
+	      wBinner& curr_binner = hc.weightsMap[untyped_hash];
+	      if (!curr_binner.is_initialized()) curr_binner.Init(bin_index, edges.size());
+
+	      // Increase the binner at index given by weights by a value given
+	      // by the number of this motif at this exact location.
+	      bin_id bin;
+	      if (curr_binner.add(curr_weights, location_count, bin))
+		{
+		  // The count at this location was successfully added, which means that
+		  // the weights at this location are included in statistics. Increase the
+		  // count of the typed motif also and save the location for sampling
+		  // the references.
+		  Motif* motif_typed = location_motifs.get(true, true);
+		  hc.motif_counts.add_at(motif_typed, 0, location_count);
+		  if (coarse_ptr && !coarse_motifs.contains(motif_typed->get_hash()))
+		    coarse_motifs.add(motif_typed->get_hash(), location_motifs.get(false, false), location_motifs.get_static());
+		  hc.locationRecords.push_back(LocationRecord(untyped_hash, motif_typed->get_hash(), bin));
+		  if (!permuted_types.empty())
+		    add_node_type_ensemble_counts(edges, location_count, node_types, motif_typed->get_hash(),
+						  permuted_types, motif_counts, coarse_ptr);
+		  else if (param.ensemble) locationIndex[edges] = locationRecords.size() - 1;
+		}
+	    }
 
 	  /* // DEBUG
 	     unsigned int sum, count;
@@ -781,6 +1760,26 @@ int main(int argc, char *argv[])
   // weightsMap[motif_hash].get_random(edge_weights) now gives a
   // random sample from the distribution of motif counts at
   // locations with given weights sequence.
+  // All distributions are now complete; create the alias tables
+  // used for drawing the samples.
+  for (unsigned int k = 0; k < hypotheses.size(); ++k)
+    {
+      WeightsMap& weightsMap = hypotheses[k]->weightsMap;
+      for (WeightsMap::iterator w_it = weightsMap.begin(); w_it != weightsMap.end(); ++w_it)
+	{
+	  w_it->second.freeze();
+	}
+    }
+
+  if (!param.state_file_name.empty())
+    {
+      std::cout << "Saving state into '" << param.state_file_name << "'.\n";
+      if (!write_state(param.state_file_name, bin_limits, hypotheses[0]->weightsMap, locationRecords, motif_counts))
+	{
+	  std::cerr << "Error: Unable to write state file '" << param.state_file_name << "'.\n";
+	  exit(1);
+	}
+    }
 
   // Note that the 'motif_hash' used as key in weightsMap defines
   // the reference system. If the hash corresponds to the untyped
@@ -798,82 +1797,79 @@ int main(int argc, char *argv[])
   // ***************************
   // *** SAMPLE MOTIF COUNTS ***
   // ***************************
-  // Iterate again over all connected sequences of at most
-  // param.max_size edges. At each location get a sample from the
-  // distribution corresponding to that untyped motif and weight
-  // sequence.
+  // Go through the locations saved above. At each location get a
+  // sample from the distribution corresponding to that untyped motif
+  // and weight sequence.
   std::cerr << "Calculating expected number of each motif.\n";
   std::cout << "Calculating expected number of each motif ("<< currentDateTime() <<").\n"; 
-  pcounter.reset();
-  for (SubnetIterator sn_it(net, param.max_size); !sn_it.finished(); ++sn_it)
+  for (unsigned int k = 0; k < hypotheses.size(); ++k)
     {
-      // Print progress.
-      pcounter.next(*sn_it);
-
-      const NodepairVector& nodePairs = *sn_it;
-
-      // Iterate through all assignments of event types on these edges.
-      for (TypeSeqs::const_iterator ets_it = event_type_seqs[nodePairs.size()].begin();
-	   ets_it != event_type_seqs[nodePairs.size()].end(); ++ets_it)
+      HypothesisCounts& hc = *hypotheses[k];
+      if (hypotheses.size() > 1) std::cout << "Null hypothesis " << param.hypotheses[k] << ":\n";
+      std::cout << "   " << hc.locationRecords.size() << " locations included in the statistics.\n";
+      if (param.analytic) add_reference_moments(hc.locationRecords, hc.weightsMap, hc.motif_counts);
+      if (!permuted_types.empty())
 	{
-	  // Get the untyped motif of the temporal subgraph with
-	  // events on the given edges.
-	  EdgeVector edges;
-	  create_edges(edges, nodePairs, *ets_it);
-
-	  TSubgraph sg(edges, node_types);
-	  Motif* motif_untyped = sg.get_motif(use_node_types, use_event_types, false);
-	  unsigned int untyped_hash = motif_untyped->get_hash();
-	  delete motif_untyped;
-
-	  // Get the weight sequence of edges. Continue if some edge
-	  // has zero weight (this is possible because we are
-	  // detecting the subgraphs in a network where all event
-	  // types have been aggregated.
-	  std::vector<unsigned int> curr_weights;
-	  if (!get_edge_weights(edges, nets, curr_weights)) continue;
-
-	  // Get a random number of this motif given the edge weights at
-	  // this location for each reference.
-	  std::vector<unsigned int> ref_counts(param.references);
-	  if (weightsMap[untyped_hash].get_random(curr_weights, ref_counts))
-	    { 
-	      // The weight sequence is included in the statistics.
-
-	      /* // DEBUG
-		 unsigned int sum, count;
-		 weightsMap[motif_ut_hash].get_sum(curr_weights, sum);
-		 weightsMap[motif_ut_hash].get_count(curr_weights, count);
-		 std::cout << *sn_it << " " << curr_weights << " (" << sum << ", " << count << ") = " << mean_count << std::endl;
-	      */
-
-	      // Get the typed motif spanned by these events.
-	      Motif* motif_typed = sg.get_typed_motif();
-
-	      // Add counts to the reference value of the typed motif (if
-	      // non-zero).
-	      unsigned int i_ref = 1;
-	      for (std::vector<unsigned int>::const_iterator ref_it = ref_counts.begin();
-		   ref_it != ref_counts.end(); ++ref_it)
-		{
-		  if (*ref_it) motif_counts.add_at(motif_typed, i_ref, *ref_it);
-		  ++i_ref;
-		}
-	    }
+	  std::cout << "   Created " << param.ensemble << " node-type permuted references.\n";
 	}
+      else if (!member_edge_types.empty())
+	{
+	  std::cerr << "Creating " << param.ensemble << " edge-type shuffled references.\n";
+	  add_edge_type_ensemble_references(ensemble_locations, events, node_types, member_edge_types,
+					    param.allow_multiple_event_types, hc.motif_counts, coarse_ptr);
+	  std::cout << "   Created " << param.ensemble << " edge-type shuffled references.\n";
+	}
+      else if (param.ensemble)
+	{
+	  std::cerr << "Creating " << param.ensemble << " time-shuffled references.\n";
+	  add_ensemble_references(*pristine_events, param, node_types, shuffle_multiplier,
+				  locationIndex, hc.locationRecords, hc.motif_counts);
+	  delete pristine_events;
+	  std::cout << "   Created " << param.ensemble << " time-shuffled references.\n";
+	}
+      else if (param.streaming)
+	{
+	  unsigned int N_used = sample_reference_stats(hc.locationRecords, hc.weightsMap, hc.motif_counts, param.references, param.rng_seed,
+						       param.tolerance, param.adaptive_min_count, param.adaptive_batch);
+	  std::cout << "   Created " << N_used << " references.\n";
+	}
+      else sample_references(hc.locationRecords, hc.weightsMap, hc.motif_counts, param.references, param.rng_seed);
     }
 
   // Print out the results.
   std::cout << "Calculations finished ("<< currentDateTime() <<")." << std::endl;
- if (motif_counts.print(param.output_file_name)) std::cout << "Results written ("<< currentDateTime() <<")." << std::endl;
-  else std::cout << "Error writing results to file! ("<< currentDateTime() <<")." << std::endl;
-
-  // Free nets.
-  for (std::map<short int, NetType*>::iterator m_it = nets.begin();
-       m_it != nets.end(); ++m_it) 
+  for (unsigned int k = 0; k < hypotheses.size(); ++k)
     {
-      //std::cerr << "Delete net with event type " << m_it->first << std::endl;
-      delete m_it->second;
-    }
+      if (param.motif_structure)
+	{
+	  std::map<unsigned int, unsigned int>::const_iterator u_it;
+	  for (u_it = coarse_motifs.untyped_hash.begin(); u_it != coarse_motifs.untyped_hash.end(); ++u_it)
+	    hypotheses[k]->motif_counts.set_structure(u_it->first, coarse_motifs.untyped_structure[u_it->second]);
+	}
+      if (write_results(hypotheses[k]->motif_counts, hypotheses[k]->output_file_name, param.binary_output)) std::cout << "Results written ("<< currentDateTime() <<")." << std::endl;
+      else std::cout << "Error writing results to file! ("<< currentDateTime() <<")." << std::endl;
 
+      // The untyped and static counts are sums of the typed counts.
+      if (param.coarse_counts)
+	{
+	  const std::string trunk = hypotheses[k]->output_file_name.substr(0, hypotheses[k]->output_file_name.size() - 4);
+	  ReferenceMotifCounter<double> untyped_counts(param.references + param.ensemble);
+	  ReferenceMotifCounter<double> static_counts(param.references + param.ensemble);
+	  untyped_counts.set_quantiles(param.quantiles);
+	  static_counts.set_quantiles(param.quantiles);
+	  hypotheses[k]->motif_counts.add_coarse_counts(untyped_counts, coarse_motifs.untyped_hash, coarse_motifs.untyped_desc);
+	  hypotheses[k]->motif_counts.add_coarse_counts(static_counts, coarse_motifs.static_hash, coarse_motifs.static_desc);
+	  if (param.motif_structure)
+	    {
+	      std::map<unsigned int, MotifStructure>::const_iterator s_it;
+	      for (s_it = coarse_motifs.untyped_structure.begin(); s_it != coarse_motifs.untyped_structure.end(); ++s_it)
+		untyped_counts.set_structure(s_it->first, s_it->second);
+	    }
+	  const std::string ext = (param.binary_output ? ".bin" : ".dat");
+	  if (!write_results(untyped_counts, trunk + "_untyped" + ext, param.binary_output) ||
+	      !write_results(static_counts, trunk + "_static" + ext, param.binary_output))
+	    std::cout << "Error writing results to file! ("<< currentDateTime() <<")." << std::endl;
+	}
+      delete hypotheses[k];
+    }
 }
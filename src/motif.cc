@@ -1,7 +1,12 @@
-/* Motif is just a bliss::digraph object. The only thing added here is
- *  a method for printing it nicely. 
+/* Motif is just a bliss::digraph object. The only things added here
+ *  are a method for printing it nicely and its type-free structure.
  */
 
+#include <vector>
+#include <map>
+#include <set>
+#include <sstream>
+#include <algorithm>
 #include "motif.h"
 
 std::ostream& operator<<(std::ostream& output, const Motif& m) 
@@ -19,3 +24,73 @@ std::ostream& operator<<(std::ostream& output, const Motif& m)
     }
   return output;
 }
+
+MotifStructure Motif::get_structure() const
+{
+  MotifStructure s;
+  const unsigned int n = get_nof_vertices();
+
+  // The nodes of each event and the temporal order of events.
+  std::vector<unsigned int> fr(n), to(n);
+  std::vector<int> next(n, -1);
+  std::vector<bool> has_prev(n, false);
+  for (unsigned int i = 0; i < n; ++i)
+    {
+      if (vertices[i].color == 0) s.nof_nodes++;
+      else s.nof_events++;
+      for (unsigned int j = 0; j < vertices[i].nof_edges_out(); ++j)
+	{
+	  unsigned int k = vertices[i].edges_out[j];
+	  if (vertices[i].color == 0) fr[k] = i;
+	  else if (vertices[k].color == 0) to[i] = k;
+	  else
+	    {
+	      next[i] = k;
+	      has_prev[k] = true;
+	    }
+	}
+    }
+
+  // Go through the events in order, labelling the nodes when they
+  // first appear.
+  std::map<unsigned int, unsigned int> labels;
+  std::set<std::pair<unsigned int, unsigned int> > edges;
+  std::ostringstream events;
+  for (unsigned int i = 0; i < n; ++i)
+    {
+      if (vertices[i].color == 0 || has_prev[i]) continue;
+      for (int e = i; e >= 0; e = next[e])
+	{
+	  if (labels.find(fr[e]) == labels.end())
+	    {
+	      unsigned int label = labels.size();
+	      labels[fr[e]] = label;
+	    }
+	  if (labels.find(to[e]) == labels.end())
+	    {
+	      unsigned int label = labels.size();
+	      labels[to[e]] = label;
+	    }
+	  unsigned int a = labels[fr[e]], b = labels[to[e]];
+	  edges.insert(std::make_pair(std::min(a, b), std::max(a, b)));
+	  if (events.tellp() > 0) events << ",";
+	  events << a << ">" << b;
+	}
+    }
+  s.nof_edges = edges.size();
+  s.events = events.str();
+
+  // The undirected graph as a symmetric directed graph.
+  bliss::Digraph g(s.nof_nodes);
+  g.set_splitting_heuristic(bliss::Digraph::shs_f);
+  for (std::set<std::pair<unsigned int, unsigned int> >::const_iterator it = edges.begin(); it != edges.end(); ++it)
+    {
+      g.add_edge(it->first, it->second);
+      g.add_edge(it->second, it->first);
+    }
+  bliss::Stats stats;
+  bliss::Digraph* g_canonical = g.permute(g.canonical_form(stats, NULL, NULL));
+  s.topo_hash = g_canonical->get_hash();
+  delete g_canonical;
+  return s;
+}
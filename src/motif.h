@@ -5,13 +5,36 @@
  */
 
 #include <ostream>
+#include <string>
 #include "graph.hh"
 
 #ifndef MOTIF_H
 #define MOTIF_H
 
+/* Properties of a motif that do not depend on the node or event
+ * types.
+ */
+struct MotifStructure
+{
+  unsigned int nof_nodes;
+  unsigned int nof_events;
+  unsigned int nof_edges; // Node pairs with events, direction ignored.
+  unsigned int topo_hash; // Hash of the underlying undirected simple graph.
+  std::string events;     // Events in temporal order, e.g. "0>1,1>2,2>0".
+  MotifStructure() : nof_nodes(0), nof_events(0), nof_edges(0), topo_hash(0), events() {};
+};
+
 class Motif : public bliss::Digraph
 {
+ public:
+  /**
+   * Find the structure of an untyped motif, where nodes have color 0
+   * and events any other color. In the event list the nodes are
+   * labelled 0, 1, ... in the order in which they first appear. In
+   * static motifs the events are in the order of the canonical form.
+   */
+  MotifStructure get_structure() const;
+
   /**
    * Print the graph on one line. Format is
    *    N [0:c_0,1:c_1,...] i,j k,l ...
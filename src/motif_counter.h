@@ -11,57 +11,52 @@ Lauri Kovanen (2/2012)
 #include <map>
 #include <string>
 #include <fstream>
+#include <iostream>
 #include <iomanip>
+#include <sstream>
+#include <stdlib.h>
+#include <stdio.h>
+#include <algorithm>
 #include "assert.h"
 #include "std_printers.h"
 #include "motif.h"
-
-template <typename T> struct MotifCount
-{
-  unsigned int count;
-  std::string* desc;
-  std::vector<T> ref_counts;
-  MotifCount();
-  ~MotifCount();
-};
-
-template <typename T> MotifCount<T>::MotifCount() 
-: count(0),desc(NULL),ref_counts() {}
-
-template <typename T> MotifCount<T>::~MotifCount() 
-{
-  delete desc;
-}
-
-template <class T> 
-std::ostream& operator<<(std::ostream& output, const MotifCount<T>& mc) 
-{
-  output << mc.count << "/" << mc.ref_counts;
-  return output;
-}
+#include "serialize.h"
+#include "result_file.h"
 
 // Abstract base class for counting motifs.
 template <typename T> class MotifCounter
 {
- private:
-  // Map for saving motif counts. The key is the motif hash, the value
-  // is a pair that consists of motif counts and a string description of
-  // the motifs.
-  typedef std::map<unsigned int, MotifCount<T> > MotifCountMap;
-
-  MotifCountMap mcm;
-
  protected:
+  // The motifs are identified by a dense id given in the order in
+  // which the motifs are added. The other values of all motifs are
+  // saved in a single row-major matrix where row 'id' contains the N
+  // values of that motif.
+  std::map<unsigned int, unsigned int> ids; // Motif hash -> id.
+  std::vector<unsigned int> hashes;          // Id -> motif hash.
+  std::vector<std::string> descs;            // Id -> motif description.
+  std::vector<unsigned int> data_counts;     // Id -> count in data.
+  std::vector<T> ref_matrix;                 // Id*N + i -> value i.
+
   unsigned int N; // Number of other values in addition to empirical one.
 
-  // Sort motifs by count in data.
+  // Add a motif unless it already exists, and return its id.
+  unsigned int add_motif(unsigned int hash, const std::string& desc);
+
+  // Called by add_motif() after a new motif has been added.
+  virtual void motif_added(unsigned int id) {};
+
+  // Id of an existing motif.
+  inline unsigned int get_id(unsigned int hash) const { return ids.find(hash)->second; };
+
+  // Sort motifs by count in data. The values of the multimap are
+  // motif ids.
   void sort_by_count(std::multimap<unsigned int, unsigned int>& sorted_counts) const;
   void sort_by_ref_count(std::multimap<T, unsigned int>& sorted_counts) const;
 
-  // Access results.
-  inline unsigned int count(unsigned int hash) const { return mcm.find(hash)->second.count; };
-  inline std::vector<T> const& counts(unsigned int hash) const { return mcm.find(hash)->second.ref_counts; };
-  inline std::string const& desc(unsigned int hash) const { return *(mcm.find(hash)->second.desc); };
+  // Access results by motif id.
+  inline unsigned int count(unsigned int id) const { return data_counts[id]; };
+  inline const T* counts(unsigned int id) const { return (N ? &ref_matrix[(size_t)id*N] : NULL); };
+  inline std::string const& desc(unsigned int id) const { return descs[id]; };
 
  public:
   // Really simple constructor.
@@ -73,24 +68,213 @@ template <typename T> class MotifCounter
   // Increase count of motif m at position i by val.
   virtual void add_at(Motif *m, unsigned int i, T val);
 
+  // Increase count of the motif with given hash at position i by
+  // val. The motif must have been added earlier with the method
+  // above.
+  virtual void add_at(unsigned int hash, unsigned int i, T val);
+
+  // True if the motif with given hash has been added.
+  bool has_motif(unsigned int hash) const { return ids.find(hash) != ids.end(); };
+
   // Print output.
   virtual bool print(const std::string& fileName) const =0;
 
-  void debug_print() const { std::cerr << mcm << std::endl; };
+  void debug_print() const { std::cerr << hashes << data_counts << ref_matrix << std::endl; };
+};
+
+// Exact moments of the reference count, summed over locations.
+struct ReferenceMoments
+{
+  double mean;     // Mean count.
+  double var;      // Variance of the count.
+  double N_loc;    // Mean number of locations where the motif occurs.
+  ReferenceMoments() : mean(0), var(0), N_loc(0) {};
+};
+
+// Statistics of the reference counts of one motif, updated one
+// reference at a time with Welford's algorithm (extended to the
+// third and fourth moments).
+struct ReferenceStats
+{
+  unsigned int n;        // Number of references.
+  double mean;           // Mean count.
+  double M2, M3, M4;     // Sums of powers of differences from the mean.
+  unsigned int N_ref;    // Number of references with non-zero count.
+  unsigned int N_lt_ref; // Number of references with count larger than in data.
+  double N_loc;          // Sum of the number of locations with the motif.
+  ReferenceStats() : n(0), mean(0), M2(0), M3(0), M4(0), N_ref(0), N_lt_ref(0), N_loc(0) {};
+
+  // After this many references with the same count the probability
+  // that a reference differs is below 1% (95% confidence, rule of
+  // three), so the counts are taken to be constant.
+  static const unsigned int MIN_CONSTANT_N = 300;
+
+  // Add the count of one reference. 'data_count' is the count in
+  // the empirical data.
+  void add(double count, unsigned int n_loc, unsigned int data_count)
+  {
+    double n1 = n;
+    n++;
+    double delta = count - mean;
+    double delta_n = delta/n;
+    double delta_n2 = delta_n*delta_n;
+    double term1 = delta*delta_n*n1;
+    mean += delta_n;
+    M4 += term1*delta_n2*((double)n*n - 3.0*n + 3) + 6*delta_n2*M2 - 4*delta_n*M3;
+    M3 += term1*delta_n*(n - 2.0) - 3*delta_n*M2;
+    M2 += term1;
+    if (count > 0) N_ref++;
+    if (data_count < count) N_lt_ref++;
+    N_loc += n_loc;
+  };
+
+  // Half-width of the 95% confidence interval of the z-score of
+  // data_count, based on the standard errors of the mean and of the
+  // standard deviation (the latter from the fourth moment). Large
+  // z-scores only need to be known relatively accurately, so the
+  // half-width is divided by max(1, |z|). If all references had the
+  // same count, the z-score is not known until MIN_CONSTANT_N
+  // references have been created.
+  double z_error(unsigned int data_count) const
+  {
+    if (n < 2) return HUGE_VAL;
+    double var = M2/n;
+    if (var <= 0) return (n < MIN_CONSTANT_N ? HUGE_VAL : 0);
+    double sd = sqrt(var);
+    double se_mean = sd/sqrt((double)n);
+    double m4 = M4/n;
+    double se_sd = sqrt(std::max(0.0, m4 - var*var)/(4*var*n));
+    double z = (data_count - mean)/sd;
+    return 1.96*sqrt(se_mean*se_mean + z*z*se_sd*se_sd)/sd/std::max(1.0, fabs(z));
+  };
+};
+
+// Read quantiles given as comma separated percentages into q (as
+// fractions). Returns false if a value is not between 0 and 100.
+inline bool parse_quantiles(const std::string& str, std::vector<double>& q)
+{
+  std::stringstream ss(str);
+  std::string item;
+  q.clear();
+  while (std::getline(ss, item, ','))
+    {
+      double val = atof(item.c_str());
+      if (item.empty() || val < 0 || val > 100) return false;
+      q.push_back(val/100);
+    }
+  return !q.empty();
+}
+
+// The values printed for one motif by ReferenceMotifCounter.
+struct ReferenceRow
+{
+  unsigned int count;
+  double ref_avg;
+  double ratio;
+  double ref_std;
+  unsigned int N_ref;
+  unsigned int N_lt_ref;
+  double z_score;
+  unsigned int N_loc_tot;
+  unsigned int N_loc;
+  double N_loc_ref;
+  std::vector<double> quantiles;
 };
 
 template <typename T> class ReferenceMotifCounter : public MotifCounter<T>
 {
  protected:
-  // Save the number of locations where the motif occurs (index 1 for 
-  // empirical data and 2-> for references) and the total number of
-  // locations in the aggregate network (index 0). Key is the motif hash.
-  std::map<unsigned int, std::vector<unsigned int> > locationCounts;
+  // The total number of locations in the aggregate network and the
+  // number of locations where the motif occurs in empirical data, by
+  // motif id. The number of locations in each reference is saved in
+  // a matrix with the same layout as the reference counts.
+  std::vector<unsigned int> loc_tot;
+  std::vector<unsigned int> loc_data;
+  std::vector<unsigned int> loc_matrix;
+  void motif_added(unsigned int id);
+
+  // Exact reference moments, if given. When these are used, the mean
+  // and standard deviation of the reference are not calculated from
+  // the reference counts. Key is the motif hash.
+  std::map<unsigned int, ReferenceMoments> moments;
+  bool use_moments;
+
+  // Reference statistics, if given. These replace the reference
+  // counts, which are then not saved at all. Key is the motif hash.
+  std::map<unsigned int, ReferenceStats> stats;
+  bool use_stats;
+
+  // Quantiles of the reference counts to print, in ascending order.
+  std::vector<double> quantiles;
+
+  // Structure of the motifs by hash. Printed if not empty.
+  std::map<unsigned int, MotifStructure> structures;
+
+  // The printed values of motif 'id'. 'row_copy' is used for
+  // calculating the quantiles.
+  void get_row(unsigned int id, std::vector<T>& row_copy, ReferenceRow& row) const;
+
+  // The structure of motif 'id', or an empty one if not known.
+  const MotifStructure& structure(unsigned int id) const;
+
+  // Motif ids in descending order of the count in data.
+  void sorted_ids(std::vector<unsigned int>& ids_out) const;
 
  public:
   ReferenceMotifCounter(unsigned int N_ref);
-  void add_at(Motif *m, unsigned int i, T val);
+  using MotifCounter<T>::add_at;
+  void add_at(unsigned int hash, unsigned int i, T val);
+
+  // Add the moments of the count distribution at one location to the
+  // exact reference moments of the motif with given hash. Since the
+  // locations are independent, the mean and variance are sums over
+  // the locations.
+  void add_moments(unsigned int hash, double mean, double var, double p_nonzero);
+
+  // Set the statistics of the reference counts of the motif with
+  // given hash. Use this with N_ref = 0 in the constructor to avoid
+  // saving the count of each reference.
+  void set_reference_stats(unsigned int hash, const ReferenceStats& rs);
+
+  // The count of the motif in the empirical data.
+  unsigned int get_count(unsigned int hash) const { return this->count(this->get_id(hash)); };
+
+  // Also print the given quantiles (between 0 and 1) of the reference
+  // counts. Requires N_ref > 0.
+  void set_quantiles(const std::vector<double>& q);
+
+  // Write all motifs and their counts into a binary stream. The
+  // reference counts are included only if 'references' is true.
+  void write(std::ostream& os, bool references) const;
+
+  // Add the counts written by write() to this counter. Reference i
+  // in the stream is added to reference offset+i (i = 1, 2, ...).
+  // The empirical counts are added only if 'empirical' is true.
+  // Returns false if the read fails or there are too few references.
+  bool read(std::istream& is, unsigned int offset, bool empirical);
+
+  // Add the counts of each motif to the motif coarse_hash[hash] of
+  // 'coarse', whose description is coarse_desc[coarse_hash[hash]].
+  // This gives the counts of motifs with less information (e.g.
+  // without types) as sums of the motifs they cover. Each location
+  // has only one motif, so the exact reference moments are sums as
+  // well. Not available with reference statistics.
+  void add_coarse_counts(ReferenceMotifCounter<T>& coarse,
+			 const std::map<unsigned int, unsigned int>& coarse_hash,
+			 const std::map<unsigned int, std::string>& coarse_desc) const;
+
+  // Print also the given structure of the motif with given hash.
+  // Ignored if there is no such motif.
+  void set_structure(unsigned int hash, const MotifStructure& s)
+  {
+    if (this->ids.find(hash) != this->ids.end()) structures[hash] = s;
+  };
+
   bool print(const std::string& fileName) const;
+
+  // Write the same results as print() in the binary format described
+  // in result_file.h.
+  bool write_binary(const std::string& fileName) const;
 };
 
 template <typename T> class SingleRefMotifCounter : public MotifCounter<T>
@@ -110,69 +294,361 @@ template <typename T> class DistributionMotifCounter : public MotifCounter<T>
 
 
 template<typename T>
-MotifCounter<T>::MotifCounter(unsigned int N) : mcm(), N(N) {}
+MotifCounter<T>::MotifCounter(unsigned int N) 
+: ids(), hashes(), descs(), data_counts(), ref_matrix(), N(N) {}
+
+template<typename T>
+unsigned int MotifCounter<T>::add_motif(unsigned int hash, const std::string& desc)
+{
+  std::map<unsigned int, unsigned int>::const_iterator id_it = ids.find(hash);
+  if (id_it != ids.end()) return id_it->second;
+
+  unsigned int id = hashes.size();
+  ids[hash] = id;
+  hashes.push_back(hash);
+  descs.push_back(desc);
+  data_counts.push_back(0);
+  ref_matrix.resize(ref_matrix.size() + N);
+  motif_added(id);
+  return id;
+}
 
 template<typename T>
 void MotifCounter<T>::add_at(Motif *m, unsigned int i, T value)
 {
-  MotifCount<T>& mc = mcm[m->get_hash()];
-  if (mc.desc == NULL) 
-    {
-      mc.desc = new std::string(to_string(*m));
-      mc.ref_counts.resize(N);
-    }
-  if (i == 0) mc.count += value;
-  else mc.ref_counts[i-1] += value;
+  if (ids.find(m->get_hash()) == ids.end()) add_motif(m->get_hash(), to_string(*m));
+  add_at(m->get_hash(), i, value);
+}
+
+template<typename T>
+void MotifCounter<T>::add_at(unsigned int hash, unsigned int i, T value)
+{
+  unsigned int id = get_id(hash);
+  if (i == 0) data_counts[id] += value;
+  else ref_matrix[(size_t)id*N + i-1] += value;
 }
 
 template<typename T>
 void MotifCounter<T>::sort_by_count(std::multimap<unsigned int, unsigned int>& sorted_counts) const
 {
-  typename MotifCountMap::const_iterator m_it;
-  for (m_it = mcm.begin(); m_it != mcm.end(); ++m_it)
+  // Go through the motifs in the order of the hash, so that motifs
+  // with equal count are always printed in the same order.
+  std::map<unsigned int, unsigned int>::const_iterator id_it;
+  for (id_it = ids.begin(); id_it != ids.end(); ++id_it)
     {
-      sorted_counts.insert(std::make_pair(m_it->second.count,m_it->first));
+      sorted_counts.insert(std::make_pair(data_counts[id_it->second], id_it->second));
     }
 }
 
 template<typename T>
 void MotifCounter<T>::sort_by_ref_count(std::multimap<T, unsigned int>& sorted_counts) const
 {
-  typename MotifCountMap::const_iterator m_it;
-  for (m_it = mcm.begin(); m_it != mcm.end(); ++m_it)
+  std::map<unsigned int, unsigned int>::const_iterator id_it;
+  for (id_it = ids.begin(); id_it != ids.end(); ++id_it)
     {
+      const T* row = counts(id_it->second);
       T total_count = 0;
-      for (typename std::vector<T>::const_iterator v_it = m_it->second.ref_counts.begin();
-	   v_it != m_it->second.ref_counts.end(); v_it++) total_count += *v_it;
-      sorted_counts.insert(std::make_pair(total_count, m_it->first));
+      for (unsigned int i = 0; i < N; i++) total_count += row[i];
+      sorted_counts.insert(std::make_pair(total_count, id_it->second));
     }
 }
 
+/* Statistics of one row of reference counts: the sum and sum of
+   squares, and the number of values that are non-zero or larger than
+   data_count. The counts are integers, so the sums are exact in any
+   order; four independent accumulators allow the compiler to
+   vectorize the loop. */
+template<typename T>
+void row_stats(const T* row, unsigned int n, T data_count,
+	       double& sum, double& sum2, unsigned int& n_nonzero, unsigned int& n_larger)
+{
+  double s[4] = {0, 0, 0, 0}, s2[4] = {0, 0, 0, 0};
+  unsigned int nz[4] = {0, 0, 0, 0}, nl[4] = {0, 0, 0, 0};
+  unsigned int i = 0;
+  for (; i + 4 <= n; i += 4)
+    {
+      for (unsigned int j = 0; j < 4; j++)
+	{
+	  double x = row[i+j];
+	  s[j] += x;
+	  s2[j] += x*x;
+	  nz[j] += (x > 0);
+	  nl[j] += (data_count < row[i+j]);
+	}
+    }
+  for (; i < n; i++)
+    {
+      double x = row[i];
+      s[0] += x;
+      s2[0] += x*x;
+      nz[0] += (x > 0);
+      nl[0] += (data_count < row[i]);
+    }
+  sum = (s[0] + s[1]) + (s[2] + s[3]);
+  sum2 = (s2[0] + s2[1]) + (s2[2] + s2[3]);
+  n_nonzero = nz[0] + nz[1] + nz[2] + nz[3];
+  n_larger = nl[0] + nl[1] + nl[2] + nl[3];
+}
+
+/* The q-quantile (0 <= q <= 1) of values, interpolating linearly
+   between the closest order statistics. The values are reordered. */
+template<typename T>
+double quantile(std::vector<T>& values, double q)
+{
+  double pos = q*(values.size() - 1);
+  size_t lo = (size_t)pos;
+  if (lo + 1 >= values.size()) lo = values.size() - 1;
+  std::nth_element(values.begin(), values.begin() + lo, values.end());
+  double res = values[lo];
+  if (lo + 1 < values.size() && pos > lo)
+    {
+      T next = *std::min_element(values.begin() + lo + 1, values.end());
+      res += (pos - lo)*(next - values[lo]);
+    }
+  return res;
+}
+
 template<typename T>
 ReferenceMotifCounter<T>::ReferenceMotifCounter(unsigned int N_ref) 
-: MotifCounter<T>(N_ref),locationCounts()
+: MotifCounter<T>(N_ref),loc_tot(),loc_data(),loc_matrix(),
+  moments(),use_moments(false),stats(),use_stats(false),quantiles()
 {}
 
 template<typename T>
-void ReferenceMotifCounter<T>::add_at(Motif *m, unsigned int i, T value)
+void ReferenceMotifCounter<T>::motif_added(unsigned int id)
 {
-  MotifCounter<T>::add_at(m,i,value);
+  loc_tot.push_back(0);
+  loc_data.push_back(0);
+  loc_matrix.resize(loc_matrix.size() + this->N);
+}
+
+template<typename T>
+void ReferenceMotifCounter<T>::set_reference_stats(unsigned int hash, const ReferenceStats& rs)
+{
+  stats[hash] = rs;
+  use_stats = true;
+}
+
+template<typename T>
+void ReferenceMotifCounter<T>::set_quantiles(const std::vector<double>& q)
+{
+  quantiles = q;
+  std::sort(quantiles.begin(), quantiles.end());
+}
+
+template<typename T>
+void ReferenceMotifCounter<T>::add_moments(unsigned int hash, double mean, double var, double p_nonzero)
+{
+  ReferenceMoments& rm = moments[hash];
+  rm.mean += mean;
+  rm.var += var;
+  rm.N_loc += p_nonzero;
+  use_moments = true;
+}
+
+template<typename T>
+void ReferenceMotifCounter<T>::add_at(unsigned int hash, unsigned int i, T value)
+{
+  unsigned int id = this->get_id(hash);
+  if (i == 0) this->data_counts[id] += value;
+  else this->ref_matrix[(size_t)id*this->N + i-1] += value;
 
   // Increment the location count.
-  std::vector<unsigned int>& v = locationCounts[m->get_hash()];
-  if (v.empty()) v.resize((this->N)+2);
-  if (i == 0) v[0]++;
-  if (value > 0) v[i+1]++;
+  if (i == 0) loc_tot[id]++;
+  if (value > 0)
+    {
+      if (i == 0) loc_data[id]++;
+      else loc_matrix[(size_t)id*this->N + i-1]++;
+    }
 }
 
 template <typename T>
-bool ReferenceMotifCounter<T>::print(const std::string& fileName) const
+void ReferenceMotifCounter<T>::write(std::ostream& os, bool references) const
 {
-  /* Sort the map keys by count in the actual data so they can be
+  // The reference counts are written sparsely: for each motif only
+  // those references where the count is non-zero.
+  write_value(os, (references ? this->N : 0u));
+  write_value(os, (unsigned int)this->ids.size());
+  std::map<unsigned int, unsigned int>::const_iterator id_it;
+  for (id_it = this->ids.begin(); id_it != this->ids.end(); ++id_it)
+    {
+      unsigned int id = id_it->second;
+      write_value(os, id_it->first);
+      write_string(os, this->desc(id));
+      write_value(os, this->count(id));
+      write_value(os, loc_tot[id]);
+      write_value(os, loc_data[id]);
+      if (!references) continue;
+
+      const T* row = this->counts(id);
+      unsigned int n_nonzero = 0;
+      for (unsigned int i = 0; i < this->N; i++) if (row[i] > 0) n_nonzero++;
+      write_value(os, n_nonzero);
+      for (unsigned int i = 0; i < this->N; i++)
+	{
+	  if (row[i] > 0)
+	    {
+	      write_value(os, i);
+	      write_value(os, row[i]);
+	      write_value(os, loc_matrix[(size_t)id*this->N + i]);
+	    }
+	}
+    }
+}
+
+template <typename T>
+bool ReferenceMotifCounter<T>::read(std::istream& is, unsigned int offset, bool empirical)
+{
+  unsigned int N_file, n_motifs;
+  if (!read_value(is, N_file) || !read_value(is, n_motifs)) return false;
+  if (offset + N_file > this->N) return false;
+  for (unsigned int i_motif = 0; i_motif < n_motifs; i_motif++)
+    {
+      unsigned int hash, count, N_loc_tot, N_loc;
+      std::string desc;
+      if (!read_value(is, hash) || !read_string(is, desc) || !read_value(is, count)
+	  || !read_value(is, N_loc_tot) || !read_value(is, N_loc)) return false;
+
+      unsigned int id = this->add_motif(hash, desc);
+      if (empirical)
+	{
+	  this->data_counts[id] += count;
+	  loc_tot[id] += N_loc_tot;
+	  loc_data[id] += N_loc;
+	}
+      if (N_file == 0) continue;
+
+      unsigned int n_nonzero, i;
+      T ref_count;
+      if (!read_value(is, n_nonzero)) return false;
+      for (unsigned int j = 0; j < n_nonzero; j++)
+	{
+	  if (!read_value(is, i) || !read_value(is, ref_count) || !read_value(is, N_loc)) return false;
+	  if (i >= N_file) return false;
+	  this->ref_matrix[(size_t)id*this->N + offset + i] += ref_count;
+	  loc_matrix[(size_t)id*this->N + offset + i] += N_loc;
+	}
+    }
+  return true;
+}
+
+template <typename T>
+void ReferenceMotifCounter<T>::add_coarse_counts(ReferenceMotifCounter<T>& coarse,
+						 const std::map<unsigned int, unsigned int>& coarse_hash,
+						 const std::map<unsigned int, std::string>& coarse_desc) const
+{
+  assert(!use_stats && coarse.N == this->N);
+  std::map<unsigned int, unsigned int>::const_iterator id_it;
+  for (id_it = this->ids.begin(); id_it != this->ids.end(); ++id_it)
+    {
+      unsigned int hash = coarse_hash.find(id_it->first)->second;
+      unsigned int id = id_it->second;
+      unsigned int c_id = coarse.add_motif(hash, coarse_desc.find(hash)->second);
+      coarse.data_counts[c_id] += this->data_counts[id];
+      coarse.loc_tot[c_id] += loc_tot[id];
+      coarse.loc_data[c_id] += loc_data[id];
+      for (unsigned int i = 0; i < this->N; i++)
+	{
+	  coarse.ref_matrix[(size_t)c_id*this->N + i] += this->ref_matrix[(size_t)id*this->N + i];
+	  coarse.loc_matrix[(size_t)c_id*this->N + i] += loc_matrix[(size_t)id*this->N + i];
+	}
+      if (use_moments)
+	{
+	  typename std::map<unsigned int, ReferenceMoments>::const_iterator m_it = moments.find(id_it->first);
+	  if (m_it != moments.end())
+	    coarse.add_moments(hash, m_it->second.mean, m_it->second.var, m_it->second.N_loc);
+	}
+    }
+}
+
+template <typename T>
+void ReferenceMotifCounter<T>::get_row(unsigned int id, std::vector<T>& row_copy, ReferenceRow& row) const
+{
+  const unsigned int N = this->N;
+  unsigned int h = this->hashes[id]; // Motif hash.
+
+  unsigned int data_count = this->count(id);
+  double avg_count, std_count;
+  unsigned int rnd_found_count, N_lt_ref;
+  row_stats(this->counts(id), N, (T)data_count, avg_count, std_count, rnd_found_count, N_lt_ref);
+  avg_count /= N;
+  std_count = std_count/N - avg_count*avg_count;
+  std_count = sqrt(std_count);
+  ReferenceStats rs;
+  if (use_stats)
+    {
+      typename std::map<unsigned int, ReferenceStats>::const_iterator rs_it = stats.find(h);
+      if (rs_it != stats.end()) rs = rs_it->second;
+      avg_count = rs.mean;
+      std_count = (rs.n ? sqrt(rs.M2/rs.n) : 0);
+      rnd_found_count = rs.N_ref;
+      N_lt_ref = rs.N_lt_ref;
+    }
+  if (use_moments)
+    {
+      const ReferenceMoments& rm = moments.find(h)->second;
+      avg_count = rm.mean;
+      std_count = sqrt(rm.var);
+    }
+  double z_score = 0.0;
+  if (std_count > 0) z_score = (((double)data_count) - avg_count)/std_count;
+  double ratio = -1.0;
+  if (avg_count > 0) ratio = ((double)data_count)/avg_count;
+
+  double N_loc_ref = 0;
+  const unsigned int* loc_row = (N ? &loc_matrix[(size_t)id*N] : NULL);
+  for (unsigned int i = 0; i < N; i++) N_loc_ref += loc_row[i];
+  N_loc_ref /= N;
+  if (use_stats) N_loc_ref = (rs.n ? rs.N_loc/rs.n : 0);
+  if (use_moments) N_loc_ref = moments.find(h)->second.N_loc;
+
+  row.count = data_count;
+  row.ref_avg = avg_count;
+  row.ratio = ratio;
+  row.ref_std = std_count;
+  row.N_ref = rnd_found_count;
+  row.N_lt_ref = N_lt_ref;
+  row.z_score = z_score;
+  row.N_loc_tot = loc_tot[id];
+  row.N_loc = loc_data[id];
+  row.N_loc_ref = N_loc_ref;
+  row.quantiles.clear();
+  if (!quantiles.empty() && N)
+    {
+      row_copy.assign(this->counts(id), this->counts(id) + N);
+      for (std::vector<double>::const_iterator q_it = quantiles.begin(); q_it != quantiles.end(); ++q_it)
+	{
+	  row.quantiles.push_back(quantile(row_copy, *q_it));
+	}
+    }
+}
+
+template <typename T>
+const MotifStructure& ReferenceMotifCounter<T>::structure(unsigned int id) const
+{
+  static const MotifStructure unknown;
+  typename std::map<unsigned int, MotifStructure>::const_iterator s_it = structures.find(this->hashes[id]);
+  return (s_it == structures.end() ? unknown : s_it->second);
+}
+
+template <typename T>
+void ReferenceMotifCounter<T>::sorted_ids(std::vector<unsigned int>& ids_out) const
+{
+  /* Sort the motif ids by count in the actual data so they can be
      easily printed in sorted order. (The multimap is automatically
      sorted by its key.) */
   std::multimap<unsigned int, unsigned int> sorted_counts;
   this->sort_by_count(sorted_counts);
+  ids_out.clear();
+  std::multimap<unsigned int, unsigned int>::reverse_iterator s_it;
+  for (s_it = sorted_counts.rbegin(); s_it != sorted_counts.rend(); ++s_it) ids_out.push_back(s_it->second);
+}
+
+template <typename T>
+bool ReferenceMotifCounter<T>::print(const std::string& fileName) const
+{
+  std::vector<unsigned int> ids_sorted;
+  sorted_ids(ids_sorted);
   
   std::cout << "Writing results to file " << std::endl;
   std::cout << "   " << fileName.c_str() << std::endl;
@@ -186,9 +662,10 @@ bool ReferenceMotifCounter<T>::print(const std::string& fileName) const
       return false;
     }
 	
-  /* Print output. */
-  unsigned int fw = 14; // field width
-  unsigned int fp = 4; // field precision
+  /* Print output. The rows are formatted with snprintf into a buffer,
+     which is much faster than the stream manipulators. The columns
+     are left-aligned with field width 14 and precision 4 (2 for
+     averages), except for the integer columns. */
   output << "count     "
 	 << "ref_avg       "
 	 << "ratio         "
@@ -198,58 +675,37 @@ bool ReferenceMotifCounter<T>::print(const std::string& fileName) const
 	 << "z-score       "
 	 << "N_loc_tot   "
 	 << "N_loc       "
-	 << "N_loc_ref     "
-	 << "N [node:color ...] edges ..." << std::endl;
-	
-  std::multimap<unsigned int, unsigned int>::reverse_iterator s_it;
-  for (s_it = sorted_counts.rbegin(); s_it != sorted_counts.rend(); ++s_it)
+	 << "N_loc_ref     ";
+  for (std::vector<double>::const_iterator q_it = quantiles.begin(); q_it != quantiles.end(); ++q_it)
     {
-      unsigned int h = s_it->second; // Motif hash.
-		
-      unsigned int data_count = this->count(h);
-      const std::vector<T>& ref_counts = this->counts(h);
-      unsigned int rnd_found_count = 0;
-      unsigned int N_lt_ref = 0;
-      double avg_count = 0, std_count = 0;
-      for (typename std::vector<T>::const_iterator v_it = ref_counts.begin(); v_it != ref_counts.end(); ++v_it)
+      output << std::setiosflags(std::ios::left) << std::setw(14) << "q" + to_string(100*(*q_it));
+    }
+  if (!structures.empty()) output << "N_nodes N_events N_edges topo_hash   events ";
+  output << "N [node:color ...] edges ..." << std::endl;
+
+  std::vector<T> row_copy; // For calculating quantiles.
+  ReferenceRow row;
+  std::vector<char> buf(1024);
+  for (std::vector<unsigned int>::const_iterator id_it = ids_sorted.begin(); id_it != ids_sorted.end(); ++id_it)
+    {
+      get_row(*id_it, row_copy, row);
+      int len = snprintf(&buf[0], buf.size(), "%-10u%-14.2f%-14.4f%-14.4f%-6u%-9u%-14.4f%-12u%-12u%-14.2f",
+			 row.count, row.ref_avg, row.ratio, row.ref_std, row.N_ref, row.N_lt_ref,
+			 row.z_score, row.N_loc_tot, row.N_loc, row.N_loc_ref);
+      output.write(&buf[0], std::min((size_t)len, buf.size() - 1));
+      for (std::vector<double>::const_iterator q_it = row.quantiles.begin(); q_it != row.quantiles.end(); ++q_it)
 	{
-	  if (*v_it > 0) {
-	    double c = (double)(*v_it);
-	    avg_count += c;
-	    std_count += c*c;
-	    rnd_found_count += 1;
-	  }
-	  if (data_count < *v_it) N_lt_ref += 1;
+	  len = snprintf(&buf[0], buf.size(), "%-14.2f", *q_it);
+	  output.write(&buf[0], std::min((size_t)len, buf.size() - 1));
 	}
-		
-      avg_count /= this->N;
-      std_count = std_count/this->N - avg_count*avg_count;
-      std_count = sqrt(std_count);
-      double z_score = 0.0;
-      if (std_count > 0) z_score = (((double)data_count) - avg_count)/std_count;
-      double ratio = -1.0;
-      if (avg_count > 0) ratio = ((double)data_count)/avg_count;
-
-      const std::vector<unsigned int>& v = locationCounts.find(h)->second;
-      std::vector<unsigned int>::const_iterator lv_it = v.begin();
-      unsigned int N_loc_tot = *lv_it; ++lv_it;
-      unsigned int N_loc = *lv_it; ++lv_it;
-      double N_loc_ref = 0;
-      for (; lv_it != v.end(); ++lv_it) N_loc_ref += *lv_it;
-      N_loc_ref /= this->N;
-		
-      output << std::setiosflags(std::ios::left)
-	     << std::setw(10) << data_count
-	     << std::setw(fw) << std::setiosflags(std::ios::fixed) << std::setprecision(2) << avg_count
-	     << std::setw(fw) << std::setiosflags(std::ios::fixed) << std::setprecision(fp) << ratio
-	     << std::setw(fw) << std::setiosflags(std::ios::fixed) << std::setprecision(fp) << std_count
-	     << std::setw(6) << rnd_found_count
-	     << std::setw(9) << N_lt_ref
-	     << std::setw(fw) << std::setiosflags(std::ios::fixed) << std::setprecision(fp) << z_score
-	     << std::setw(12) << N_loc_tot
-	     << std::setw(12) << N_loc
-	     << std::setw(fw) << std::setiosflags(std::ios::fixed) << std::setprecision(2) << N_loc_ref
-	     << this->desc(h) << std::endl;
+      if (!structures.empty())
+	{
+	  const MotifStructure& ms = structure(*id_it);
+	  len = snprintf(&buf[0], buf.size(), "%-8u%-9u%-8u%-12u", ms.nof_nodes, ms.nof_events, ms.nof_edges, ms.topo_hash);
+	  output.write(&buf[0], std::min((size_t)len, buf.size() - 1));
+	  output << (ms.events.empty() ? "-" : ms.events) << ' ';
+	}
+      output << this->desc(*id_it) << '\n';
     }
 	
   output.close();
@@ -261,6 +717,95 @@ bool ReferenceMotifCounter<T>::print(const std::string& fileName) const
   return true;
 }
 
+template <typename T>
+bool ReferenceMotifCounter<T>::write_binary(const std::string& fileName) const
+{
+  std::vector<unsigned int> ids_sorted;
+  sorted_ids(ids_sorted);
+  const unsigned int n = ids_sorted.size();
+
+  std::cout << "Writing results to file " << std::endl;
+  std::cout << "   " << fileName.c_str() << std::endl;
+
+  // Collect the columns in the order of the text output.
+  std::vector<unsigned int> count(n), N_ref(n), N_lt_ref(n), N_loc_tot(n), N_loc(n), hash(n);
+  std::vector<double> ref_avg(n), ratio(n), ref_std(n), z_score(n), N_loc_ref(n);
+  std::vector<std::vector<double> > q_cols(quantiles.size(), std::vector<double>(n));
+  std::vector<unsigned int> N_nodes(n), N_events(n), N_edges(n), topo_hash(n);
+  std::vector<unsigned long long> desc_offsets(n + 1, 0), event_offsets(n + 1, 0);
+  std::string descs, events;
+  std::vector<T> row_copy;
+  ReferenceRow row;
+  for (unsigned int k = 0; k < n; k++)
+    {
+      unsigned int id = ids_sorted[k];
+      get_row(id, row_copy, row);
+      count[k] = row.count;
+      ref_avg[k] = row.ref_avg;
+      ratio[k] = row.ratio;
+      ref_std[k] = row.ref_std;
+      N_ref[k] = row.N_ref;
+      N_lt_ref[k] = row.N_lt_ref;
+      z_score[k] = row.z_score;
+      N_loc_tot[k] = row.N_loc_tot;
+      N_loc[k] = row.N_loc;
+      N_loc_ref[k] = row.N_loc_ref;
+      for (unsigned int j = 0; j < row.quantiles.size(); j++) q_cols[j][k] = row.quantiles[j];
+      hash[k] = this->hashes[id];
+      if (!structures.empty())
+	{
+	  const MotifStructure& ms = structure(id);
+	  N_nodes[k] = ms.nof_nodes;
+	  N_events[k] = ms.nof_events;
+	  N_edges[k] = ms.nof_edges;
+	  topo_hash[k] = ms.topo_hash;
+	  events += ms.events;
+	  event_offsets[k+1] = events.size();
+	}
+      const std::string& d = this->desc(id);
+      descs.append(d, 0, d.find_last_not_of(' ') + 1);
+      desc_offsets[k+1] = descs.size();
+    }
+
+  // Column directory: name, NumPy type and offset of each column.
+  // The 8-byte columns come first so that every column is aligned.
+  ResultColumns columns;
+  columns.add_double("ref_avg", ref_avg);
+  columns.add_double("ratio", ratio);
+  columns.add_double("ref_std", ref_std);
+  columns.add_double("z-score", z_score);
+  columns.add_double("N_loc_ref", N_loc_ref);
+  for (unsigned int j = 0; j < quantiles.size(); j++) columns.add_double("q" + to_string(100*quantiles[j]), q_cols[j]);
+  columns.add_uint("count", count);
+  columns.add_uint("N_ref", N_ref);
+  columns.add_uint("N_lt_ref", N_lt_ref);
+  columns.add_uint("N_loc_tot", N_loc_tot);
+  columns.add_uint("N_loc", N_loc);
+  columns.add_uint("hash", hash);
+  if (!structures.empty())
+    {
+      columns.add_uint("N_nodes", N_nodes);
+      columns.add_uint("N_events", N_events);
+      columns.add_uint("N_edges", N_edges);
+      columns.add_uint("topo_hash", topo_hash);
+      columns.add_strings("events", event_offsets, events);
+    }
+
+  std::ofstream output(fileName.c_str(), std::ios::binary);
+  if (output.fail())
+    {
+      perror("Failed to open output file");
+      return false;
+    }
+  columns.write(output, n, desc_offsets, descs);
+  output.close();
+  if (output.fail())
+    {
+      perror("Failed to close output file");
+      return false;
+    }
+  return true;
+}
 
 template<typename T>
 SingleRefMotifCounter<T>::SingleRefMotifCounter() 
@@ -270,7 +815,7 @@ SingleRefMotifCounter<T>::SingleRefMotifCounter()
 template <typename T>
 bool SingleRefMotifCounter<T>::print(const std::string& fileName) const
 {
-  /* Sort the map keys by count in the actual data so they can be
+  /* Sort the motif ids by count in the actual data so they can be
      easily printed in sorted order. (The multimap is automatically
      sorted by its key.) */
   std::multimap<unsigned int, unsigned int> sorted_counts;
@@ -296,7 +841,7 @@ bool SingleRefMotifCounter<T>::print(const std::string& fileName) const
   std::multimap<unsigned int, unsigned int>::reverse_iterator s_it;
   for (s_it = sorted_counts.rbegin(); s_it != sorted_counts.rend(); ++s_it)
     {
-      unsigned int h = s_it->second; // Motif hash.
+      unsigned int h = s_it->second; // Motif id.
 		
       unsigned int data_count = this->count(h);
       T ref_count = this->counts(h)[0];
@@ -347,13 +892,12 @@ bool DistributionMotifCounter<T>::print(const std::string& fileName) const
   typename std::multimap<T, unsigned int>::reverse_iterator s_it;
   for (s_it = sorted_counts.rbegin(); s_it != sorted_counts.rend(); ++s_it)
     {
-      unsigned int h = s_it->second; // Motif hash.
+      unsigned int h = s_it->second; // Motif id.
 
       // Print counts separated by commas.
-      const std::vector<T>& ref_counts = this->counts(h);      
-      std::vector<unsigned int>::const_iterator v_it = ref_counts.begin();
-      output << *v_it; v_it++;
-      for (; v_it != ref_counts.end(); v_it++) output << "," << *v_it;
+      const T* ref_counts = this->counts(h);
+      output << ref_counts[0];
+      for (unsigned int i = 1; i < this->N; i++) output << "," << ref_counts[i];
 
       // Print the motif string.
       output << " " << this->desc(h) << std::endl;
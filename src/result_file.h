@@ -0,0 +1,153 @@
+/*
+Binary result files.
+
+The binary result file contains the same columns as the text output
+of 'tmf', in the same order of rows, but each column is stored as a
+contiguous array so that it can be read without parsing (e.g. with
+numpy.memmap, see python/result_file.py). The values are in the
+native byte order, which is given in the type of each column.
+
+Layout (all offsets in bytes from the beginning of the file, every
+block aligned to 8 bytes):
+
+   char[8]   tag "TMFRES  "
+   uint32    format version
+   uint32    number of rows (motifs)
+   uint32    number of columns
+   uint32    reserved (0)
+   uint64    offset of the description offsets
+   uint64    offset of the descriptions
+   uint64    total length of the descriptions
+
+   Column directory, one entry per column:
+   char[24]  column name, padded with zeros
+   char[8]   NumPy type, e.g. "<f8" or "<u4", or "str", padded with zeros
+   uint64    offset of the column
+
+   The columns. A column of type "str" consists of uint64[rows+1]
+   offsets followed by the characters, as with the descriptions.
+
+   uint64[rows+1]  description offsets: the description of motif i
+                   is characters offsets[i], ..., offsets[i+1]-1.
+   char[]          the descriptions (motif in the format of the last
+                   column of the text output) without separators.
+*/
+
+#ifndef RESULT_FILE_H
+#define RESULT_FILE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+#include "serialize.h"
+
+class ResultColumns
+{
+ private:
+  static const unsigned int VERSION = 1;
+  static const size_t NAME_LENGTH = 24;
+  static const size_t TYPE_LENGTH = 8;
+
+  struct Column
+  {
+    std::string name;
+    std::string type;
+    const char* data;
+    size_t size;  // Size of the data in bytes.
+    const char* chars; // Characters of a string column.
+    size_t n_chars;
+  };
+  std::vector<Column> columns;
+
+  static bool little_endian()
+  {
+    uint32_t x = 1;
+    return *(const char*)&x == 1;
+  };
+
+  static size_t padded(size_t n) { return (n + 7)/8*8; };
+
+  static void write_padded(std::ostream& os, const char* data, size_t n, size_t n_total)
+  {
+    os.write(data, n);
+    for (size_t i = n; i < n_total; i++) os.put('\0');
+  };
+
+  void add(const std::string& name, char kind, size_t elem_size, const char* data, size_t n)
+  {
+    Column c;
+    c.name = name;
+    c.type = std::string(1, little_endian() ? '<' : '>') + kind + (char)('0' + elem_size);
+    c.data = data;
+    c.size = n*elem_size;
+    c.chars = NULL;
+    c.n_chars = 0;
+    columns.push_back(c);
+  };
+
+ public:
+  /* Add a column. The data is not copied, so the vector must exist
+     until write() is called. */
+  void add_double(const std::string& name, const std::vector<double>& v)
+  {
+    add(name, 'f', sizeof(double), (v.empty() ? NULL : (const char*)&v[0]), v.size());
+  };
+  void add_uint(const std::string& name, const std::vector<unsigned int>& v)
+  {
+    add(name, 'u', sizeof(unsigned int), (v.empty() ? NULL : (const char*)&v[0]), v.size());
+  };
+
+  /* Add a column of strings: string i is characters offsets[i], ...,
+     offsets[i+1]-1 of 'chars'. */
+  void add_strings(const std::string& name, const std::vector<unsigned long long>& offsets,
+		   const std::string& chars)
+  {
+    add(name, 0, sizeof(unsigned long long), (const char*)&offsets[0], offsets.size());
+    columns.back().type = "str";
+    columns.back().chars = chars.data();
+    columns.back().n_chars = chars.size();
+  };
+
+  /* Write the file. */
+  void write(std::ostream& os, unsigned int n_rows,
+	     const std::vector<unsigned long long>& desc_offsets,
+	     const std::string& descs) const
+  {
+    const size_t header_size = 48 + columns.size()*(NAME_LENGTH + TYPE_LENGTH + 8);
+    std::vector<unsigned long long> offsets;
+    unsigned long long pos = header_size;
+    for (size_t i = 0; i < columns.size(); i++)
+      {
+	offsets.push_back(pos);
+	pos += padded(columns[i].size + columns[i].n_chars);
+      }
+    const unsigned long long desc_offsets_pos = pos;
+    const unsigned long long descs_pos = pos + desc_offsets.size()*sizeof(unsigned long long);
+
+    os.write("TMFRES  ", 8);
+    write_value(os, (unsigned int)VERSION);
+    write_value(os, n_rows);
+    write_value(os, (unsigned int)columns.size());
+    write_value(os, 0u);
+    write_value(os, desc_offsets_pos);
+    write_value(os, descs_pos);
+    write_value(os, (unsigned long long)descs.size());
+    for (size_t i = 0; i < columns.size(); i++)
+      {
+	write_padded(os, columns[i].name.c_str(), std::min(columns[i].name.size(), NAME_LENGTH - 1), NAME_LENGTH);
+	write_padded(os, columns[i].type.c_str(), columns[i].type.size(), TYPE_LENGTH);
+	write_value(os, offsets[i]);
+      }
+    for (size_t i = 0; i < columns.size(); i++)
+      {
+	os.write(columns[i].data, columns[i].size);
+	write_padded(os, columns[i].chars, columns[i].n_chars, padded(columns[i].size + columns[i].n_chars) - columns[i].size);
+      }
+    os.write((const char*)&desc_offsets[0], desc_offsets.size()*sizeof(unsigned long long));
+    os.write(descs.data(), descs.size());
+  };
+};
+
+#endif
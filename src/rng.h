@@ -0,0 +1,179 @@
+/*
+Counter-based random numbers.
+
+All random numbers are generated with Philox4x32-10 (Salmon et al.,
+"Parallel random numbers: as easy as 1, 2, 3", SC 2011). The
+generator is a pure function of a 128-bit counter and a 64-bit key,
+so any number of independent streams can be created from a single
+seed and the numbers do not depend on the order in which they are
+used. The key consists of the seed and a purpose that separates
+the different uses (references, shuffles); the counter consists of
+the position in the stream and the stream id (e.g. reference index
+or thread number).
+*/
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+
+// Different uses of random numbers get different keys.
+enum RngPurpose
+  {
+    RNG_REFERENCES = 1,
+    RNG_TIME_SHUFFLE,
+    RNG_EVENT_TYPE_SHUFFLE,
+    RNG_EDGE_TYPE_SHUFFLE,
+    RNG_NODE_TYPE_SHUFFLE
+  };
+
+/* Philox4x32 with 10 rounds: four random 32-bit words for the given
+   counter and key. */
+inline void philox4x32_10(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4])
+{
+  const uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+  const uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+  uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+  uint32_t k0 = key[0], k1 = key[1];
+  for (int round = 0; round < 10; round++)
+    {
+      uint64_t p0 = (uint64_t)M0*c0;
+      uint64_t p1 = (uint64_t)M1*c2;
+      uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+      uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+      c1 = (uint32_t)p1;
+      c3 = (uint32_t)p0;
+      c0 = n0;
+      c2 = n2;
+      k0 += W0;
+      k1 += W1;
+    }
+  out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+/* Uniform double in [0,1) with 53 random bits from two words. */
+inline double words_to_double(uint32_t a, uint32_t b)
+{
+  return ((a >> 5)*67108864.0 + (b >> 6))*(1.0/9007199254740992.0);
+}
+
+/* The uniform random number in [0,1) at position i of stream j. This
+   is the first number RandomStream(seed, purpose, j) would give after
+   skipping i blocks, but it can be calculated in any order. */
+inline double random_uniform(uint32_t seed, uint32_t purpose, uint64_t i, uint64_t j)
+{
+  uint32_t ctr[4] = {(uint32_t)i, (uint32_t)(i >> 32), (uint32_t)j, (uint32_t)(j >> 32)};
+  uint32_t key[2] = {seed, purpose};
+  uint32_t out[4];
+  philox4x32_10(ctr, key, out);
+  return words_to_double(out[0], out[1]);
+}
+
+/* The uniform random numbers in [0,1) at positions first, ...,
+   first+n-1 of stream j, i.e. the numbers RandomStream(seed,
+   purpose, j) would give after skipping 'first' numbers. Each
+   Philox block gives two numbers, so the number at a position does
+   not depend on how the positions are split between calls. */
+inline void random_uniforms(uint32_t seed, uint32_t purpose, uint64_t j,
+			    uint64_t first, size_t n, double* u)
+{
+  uint32_t ctr[4] = {0, 0, (uint32_t)j, (uint32_t)(j >> 32)};
+  const uint32_t key[2] = {seed, purpose};
+  uint32_t out[4];
+  uint64_t block = first/2;
+  size_t i = 0;
+
+  // An odd first position uses the second half of its block.
+  if (n && first % 2)
+    {
+      ctr[0] = (uint32_t)block; ctr[1] = (uint32_t)(block >> 32);
+      philox4x32_10(ctr, key, out);
+      u[i++] = words_to_double(out[2], out[3]);
+      block++;
+    }
+  // Whole blocks; the iterations are independent.
+  for (; i + 1 < n; i += 2, block++)
+    {
+      ctr[0] = (uint32_t)block; ctr[1] = (uint32_t)(block >> 32);
+      philox4x32_10(ctr, key, out);
+      u[i] = words_to_double(out[0], out[1]);
+      u[i + 1] = words_to_double(out[2], out[3]);
+    }
+  if (i < n)
+    {
+      ctr[0] = (uint32_t)block; ctr[1] = (uint32_t)(block >> 32);
+      philox4x32_10(ctr, key, out);
+      u[i] = words_to_double(out[0], out[1]);
+    }
+}
+
+/* Class: RandomStream
+
+   A sequential stream of random numbers. Streams with a different
+   seed, purpose or stream id are independent.
+*/
+class RandomStream
+{
+ private:
+  uint32_t key[2];
+  uint32_t ctr[4];   // Block index (64 bits) and stream id (64 bits).
+  uint32_t buf[4];   // Current block.
+  unsigned int pos;  // Next unused word in buf.
+
+  void next_block()
+  {
+    philox4x32_10(ctr, key, buf);
+    if (++ctr[0] == 0) ++ctr[1];
+    pos = 0;
+  };
+
+ public:
+  RandomStream(uint32_t seed, uint32_t purpose, uint64_t stream = 0) : pos(4)
+  {
+    key[0] = seed;
+    key[1] = purpose;
+    ctr[0] = ctr[1] = 0;
+    ctr[2] = (uint32_t)stream;
+    ctr[3] = (uint32_t)(stream >> 32);
+  };
+
+  uint32_t next_uint32()
+  {
+    if (pos == 4) next_block();
+    return buf[pos++];
+  };
+
+  /* Uniform double in [0,1). */
+  double next_double()
+  {
+    uint32_t a = next_uint32();
+    return words_to_double(a, next_uint32());
+  };
+
+  /* Uniform integer in 0, ..., n-1 without bias (Lemire's method). */
+  uint32_t next_below(uint32_t n)
+  {
+    uint64_t m = (uint64_t)next_uint32()*n;
+    if ((uint32_t)m < n)
+      {
+	uint32_t threshold = (uint32_t)(-n) % n;
+	while ((uint32_t)m < threshold) m = (uint64_t)next_uint32()*n;
+      }
+    return (uint32_t)(m >> 32);
+  };
+};
+
+/* Shuffle the range [first, last) uniformly (Fisher-Yates). */
+template<typename Iterator>
+void shuffle_range(Iterator first, Iterator last, RandomStream& rng)
+{
+  for (ptrdiff_t n = last - first; n > 1; --n)
+    {
+      ptrdiff_t j = rng.next_below((uint32_t)n);
+      std::swap(first[n-1], first[j]);
+    }
+}
+
+#endif
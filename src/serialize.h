@@ -0,0 +1,112 @@
+/*
+Helpers for reading and writing binary files.
+
+The values are written in the native byte order of the machine, so
+the files can only be read on machines with the same architecture.
+All read functions return false if the read fails. Vectors and
+strings are read in chunks of at most READ_CHUNK bytes, so a corrupt
+length fails at the end of the file instead of allocating memory for
+all of it.
+*/
+
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+static const unsigned long long READ_CHUNK = 1 << 20;
+
+/* Single values of plain data types. */
+template<typename T>
+inline void write_value(std::ostream& os, const T& val)
+{
+  os.write((const char*)&val, sizeof(T));
+}
+
+template<typename T>
+inline bool read_value(std::istream& is, T& val)
+{
+  is.read((char*)&val, sizeof(T));
+  return !is.fail();
+}
+
+/* Vectors of plain data types, preceded by the length. */
+template<typename T>
+inline void write_vector(std::ostream& os, const std::vector<T>& v)
+{
+  write_value(os, (unsigned long long)v.size());
+  if (!v.empty()) os.write((const char*)&v[0], v.size()*sizeof(T));
+}
+
+template<typename T>
+inline bool read_vector(std::istream& is, std::vector<T>& v)
+{
+  unsigned long long n;
+  if (!read_value(is, n)) return false;
+  const unsigned long long chunk = READ_CHUNK/sizeof(T) + 1;
+  v.clear();
+  while (v.size() < n)
+    {
+      const size_t start = v.size();
+      const size_t k = (size_t)std::min(chunk, n - start);
+      v.resize(start + k);
+      is.read((char*)&v[start], k*sizeof(T));
+      if (is.fail())
+	{
+	  v.clear();
+	  return false;
+	}
+    }
+  return true;
+}
+
+/* Strings, preceded by the length. */
+inline void write_string(std::ostream& os, const std::string& s)
+{
+  write_value(os, (unsigned int)s.size());
+  os.write(s.data(), s.size());
+}
+
+inline bool read_string(std::istream& is, std::string& s)
+{
+  unsigned int n;
+  if (!read_value(is, n)) return false;
+  s.clear();
+  while (s.size() < n)
+    {
+      const size_t start = s.size();
+      const size_t k = (size_t)std::min(READ_CHUNK, (unsigned long long)(n - start));
+      s.resize(start + k);
+      is.read(&s[start], k);
+      if (is.fail())
+	{
+	  s.clear();
+	  return false;
+	}
+    }
+  return true;
+}
+
+/* File identifiers: a tag of exactly 8 characters followed by the
+   format version. read_header() returns false if either differs
+   from the expected one. */
+inline void write_header(std::ostream& os, const char* tag, unsigned int version)
+{
+  os.write(tag, 8);
+  write_value(os, version);
+}
+
+inline bool read_header(std::istream& is, const char* tag, unsigned int version)
+{
+  char buf[8];
+  unsigned int file_version;
+  is.read(buf, 8);
+  if (is.fail() || memcmp(buf, tag, 8) != 0) return false;
+  return read_value(is, file_version) && file_version == version;
+}
+
+#endif
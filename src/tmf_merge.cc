@@ -0,0 +1,145 @@
+/* tmf-merge - Combine references created by tmf-sample
+
+Copyright (C) 2013  Lauri Kovanen
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see {http://www.gnu.org/licenses/}.
+*/
+
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "binner.h"
+#include "motif_counter.h"
+#include "locations.h"
+
+void print_help()
+{
+  std::cout << "Usage:\n"
+	    << "   ./tmf-merge OUTPUTNAME STATEFILE [--analytic] [--quantiles LIST] [--binary_output] REFFILE ...\n\n"
+	    << "Combine the references in the files REFFILE, created by 'tmf-sample' from STATEFILE,\n"
+	    << "and write the results into OUTPUTNAME.dat in the same format as 'tmf'. The files\n"
+	    << "must contain different references: either different seeds, or the same seed with\n"
+	    << "non-overlapping ranges given with 'tmf-sample --first'. Files created from another\n"
+	    << "state file or containing the same references are rejected.\n\n"
+	    << "--quantiles LIST\n"
+	    << "  Also print the given quantiles of the reference counts, as with 'tmf --quantiles'.\n\n"
+	    << "--analytic\n"
+	    << "  Calculate the mean and standard deviation of the reference counts exactly, as with\n"
+	    << "  'tmf --analytic'.\n\n"
+	    << "--binary_output\n"
+	    << "  Write the results into OUTPUTNAME.bin in the binary format of 'tmf --binary_output'.\n\n";
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 4)
+    {
+      print_help();
+      exit(1);
+    }
+  std::string output_trunk(argv[1]);
+  std::string state_file_name(argv[2]);
+  bool analytic = false;
+  bool binary_output = false;
+  std::vector<double> quantiles;
+  std::vector<std::string> ref_file_names;
+  for (int i = 3; i < argc; i++)
+    {
+      std::string name(argv[i]);
+      if (name.compare("--analytic") == 0) analytic = true;
+      else if (name.compare("--binary_output") == 0) binary_output = true;
+      else if (name.compare("--quantiles") == 0)
+	{
+	  if (i + 1 == argc || !parse_quantiles(argv[++i], quantiles))
+	    {
+	      print_help();
+	      exit(1);
+	    }
+	}
+      else ref_file_names.push_back(name);
+    }
+
+  uint64_t state_digest;
+  if (!get_state_digest(state_file_name, state_digest))
+    {
+      std::cerr << "Error: Unable to read state file '" << state_file_name << "'.\n";
+      exit(1);
+    }
+
+  // Find the total number of references, and make sure that every
+  // file was created from this state and that no reference (seed and
+  // index) is included twice.
+  std::vector<unsigned int> offsets;
+  std::vector<ReferenceFileInfo> infos;
+  unsigned int references = 0;
+  for (unsigned int i = 0; i < ref_file_names.size(); i++)
+    {
+      ReferenceFileInfo info;
+      if (!read_reference_info(ref_file_names[i], info))
+	{
+	  std::cerr << "Error: Unable to read reference file '" << ref_file_names[i] << "'.\n";
+	  exit(1);
+	}
+      if (info.state_digest != state_digest)
+	{
+	  std::cerr << "Error: Reference file '" << ref_file_names[i] << "' was not created from state file '"
+		    << state_file_name << "'.\n";
+	  exit(1);
+	}
+      for (unsigned int j = 0; j < infos.size(); j++)
+	{
+	  if (infos[j].seed == info.seed &&
+	      (unsigned long long)infos[j].first_ref + infos[j].N_ref > info.first_ref &&
+	      (unsigned long long)info.first_ref + info.N_ref > infos[j].first_ref)
+	    {
+	      std::cerr << "Error: Reference files '" << ref_file_names[j] << "' and '" << ref_file_names[i]
+			<< "' contain the same references (seed " << info.seed << ").\n";
+	      exit(1);
+	    }
+	}
+      infos.push_back(info);
+      offsets.push_back(references);
+      references += info.N_ref;
+    }
+  std::cout << "Combining " << references << " references from " 
+	    << ref_file_names.size() << " files.\n";
+
+  BinIndex bin_index;
+  WeightsMap weightsMap;
+  LocationRecords locationRecords;
+  ReferenceMotifCounter<double> motif_counts(references);
+  if (!read_state(state_file_name, bin_index, weightsMap, locationRecords, motif_counts))
+    {
+      std::cerr << "Error: Unable to read state file '" << state_file_name << "'.\n";
+      exit(1);
+    }
+  for (unsigned int i = 0; i < ref_file_names.size(); i++)
+    {
+      if (!read_references(ref_file_names[i], motif_counts, offsets[i]))
+	{
+	  std::cerr << "Error: Unable to read reference file '" << ref_file_names[i] << "'.\n";
+	  exit(1);
+	}
+    }
+  if (!quantiles.empty() && references) motif_counts.set_quantiles(quantiles);
+  if (analytic) add_reference_moments(locationRecords, weightsMap, motif_counts);
+
+  if (binary_output)
+    {
+      if (!motif_counts.write_binary(output_trunk + ".bin")) exit(1);
+    }
+  else if (!motif_counts.print(output_trunk + ".dat")) exit(1);
+  return 0;
+}
@@ -0,0 +1,109 @@
+/* tmf-sample - Create references from a state saved by TMFinder
+
+Copyright (C) 2013  Lauri Kovanen
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see {http://www.gnu.org/licenses/}.
+*/
+
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include <iostream>
+#include "binner.h"
+#include "motif_counter.h"
+#include "locations.h"
+
+void print_help()
+{
+  std::cout << "Usage:\n"
+	    << "   ./tmf-sample STATEFILE REFFILE [-r INT] [-s INT] [--first INT]\n\n"
+	    << "Create references from STATEFILE, written by 'tmf --save_state', and save them\n"
+	    << "into REFFILE. Files created with different seeds, or with the same seed and\n"
+	    << "non-overlapping references, can be combined with 'tmf-merge'. REFFILE records\n"
+	    << "the state file, the seed and the references it contains.\n\n"
+	    << "-r INT | --references INT\n"
+	    << "  The number of references to create (default 1).\n\n"
+	    << "-s INT | --seed INT\n"
+	    << "  The seed for the random number generator. If omitted the system time is used.\n\n"
+	    << "--first INT\n"
+	    << "  Index of the first reference to create (default 0). With the same seed,\n"
+	    << "  '--first 0 -r 100' and '--first 100 -r 100' together give the same references\n"
+	    << "  as '-r 200' or 'tmf -r 200'.\n\n";
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 3)
+    {
+      print_help();
+      exit(1);
+    }
+  std::string state_file_name(argv[1]);
+  std::string ref_file_name(argv[2]);
+  unsigned int references = 1;
+  unsigned int rng_seed = time(NULL);
+  unsigned int first_ref = 0;
+  for (int i = 3; i < argc; i++)
+    {
+      std::string name(argv[i]);
+      if (i + 1 < argc && (name.compare("-r") == 0 || name.compare("--references") == 0))
+	references = atoi(argv[++i]);
+      else if (i + 1 < argc && (name.compare("-s") == 0 || name.compare("--seed") == 0))
+	rng_seed = atoi(argv[++i]);
+      else if (i + 1 < argc && name.compare("--first") == 0)
+	first_ref = atoi(argv[++i]);
+      else
+	{
+	  std::cout << "   Unidentified parameter '" << name << "'.\n\n";
+	  print_help();
+	  exit(1);
+	}
+    }
+  std::cout << "Reading state from '" << state_file_name << "'.\n";
+  BinIndex bin_index;
+  WeightsMap weightsMap;
+  LocationRecords locationRecords;
+  ReferenceMotifCounter<double> motif_counts(references);
+  if (!read_state(state_file_name, bin_index, weightsMap, locationRecords, motif_counts))
+    {
+      std::cerr << "Error: Unable to read state file '" << state_file_name << "'.\n";
+      exit(1);
+    }
+  ReferenceFileInfo info;
+  if (!get_state_digest(state_file_name, info.state_digest))
+    {
+      std::cerr << "Error: Unable to read state file '" << state_file_name << "'.\n";
+      exit(1);
+    }
+  info.seed = rng_seed;
+  info.first_ref = first_ref;
+  info.N_ref = references;
+  std::cout << "   " << locationRecords.size() << " locations included in the statistics.\n";
+
+  std::cout << "Creating " << references << " references (seed " << rng_seed
+	    << ", first reference " << first_ref << ").\n";
+  for (WeightsMap::iterator w_it = weightsMap.begin(); w_it != weightsMap.end(); ++w_it)
+    {
+      w_it->second.freeze();
+    }
+  sample_references(locationRecords, weightsMap, motif_counts, references, rng_seed, first_ref);
+
+  if (!write_references(ref_file_name, info, motif_counts))
+    {
+      std::cerr << "Error: Unable to write reference file '" << ref_file_name << "'.\n";
+      exit(1);
+    }
+  std::cout << "References written into '" << ref_file_name << "'.\n";
+  return 0;
+}
@@ -0,0 +1,86 @@
+"""Compare a binary result file (tmf --binary_output) against the text
+output of the same run. Every column of the text file must have the
+same value in the binary file, shown with the precision of the text,
+and the motif descriptions must be the same.
+
+The binary file is read with the standard library, following the
+layout in src/result_file.h (see also python/result_file.py), so that
+the check does not need NumPy.
+
+Usage: python compare_results.py TEXTFILE BINFILE
+Exits with status 0 if the files agree.
+"""
+import math
+import struct
+import sys
+
+HEADER_SIZE = 48
+ENTRY_SIZE = 40
+
+def read_strings(data, offset, n_rows, chars_pos=None):
+    offsets = struct.unpack_from("<%dQ" % (n_rows + 1), data, offset)
+    if chars_pos is None:
+        chars_pos = offset + 8*(n_rows + 1)
+    return [data[chars_pos + offsets[i]:chars_pos + offsets[i+1]].decode("ascii")
+            for i in range(n_rows)]
+
+def read_binary(filename):
+    with open(filename, "rb") as f:
+        data = f.read()
+    tag, version, n_rows, n_cols, _, desc_offsets_pos, descs_pos, _ = \
+        struct.unpack_from("<8sIIIIQQQ", data, 0)
+    if tag != b"TMFRES  " or version != 1:
+        raise ValueError("'%s' is not a binary result file." % (filename,))
+    columns = {}
+    for i in range(n_cols):
+        entry = data[HEADER_SIZE + i*ENTRY_SIZE:HEADER_SIZE + (i+1)*ENTRY_SIZE]
+        name = entry[:24].rstrip(b"\0").decode("ascii")
+        type_str = entry[24:32].rstrip(b"\0").decode("ascii")
+        offset = struct.unpack("<Q", entry[32:40])[0]
+        if type_str == "str":
+            columns[name] = read_strings(data, offset, n_rows)
+        else:
+            fmt = {"f8": "d", "u4": "I"}[type_str[1:]]
+            columns[name] = struct.unpack_from(type_str[0] + fmt*n_rows, data, offset)
+    descs = read_strings(data, desc_offsets_pos, n_rows, descs_pos)
+    return columns, descs
+
+def same_value(token, value):
+    if not isinstance(value, (int, float)):
+        return token == value
+    if isinstance(value, float):
+        if math.isnan(value):
+            return "nan" in token
+        if "." in token:
+            return token == "%.*f" % (len(token) - token.index(".") - 1, value)
+        return float(token) == value
+    return int(token) == value
+
+def compare(text_file, bin_file):
+    columns, descs = read_binary(bin_file)
+    with open(text_file) as f:
+        header = f.readline().split()
+        names = header[:header.index("[node:color") - 1]
+        rows = [line.split() for line in f if line.strip()]
+    if len(rows) != len(descs):
+        print("Different number of motifs: %d and %d." % (len(rows), len(descs)))
+        return False
+    for name in names:
+        if name not in columns:
+            print("Column '%s' is missing from the binary file." % (name,))
+            return False
+    for i, row in enumerate(rows):
+        for k, name in enumerate(names):
+            if not same_value(row[k], columns[name][i]):
+                print("Row %d, column '%s': %s and %r." % (i, name, row[k], columns[name][i]))
+                return False
+        if row[len(names):] != descs[i].split():
+            print("Row %d: different motifs." % (i,))
+            return False
+    return True
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        print(__doc__)
+        sys.exit(2)
+    sys.exit(0 if compare(sys.argv[1], sys.argv[2]) else 1)
@@ -0,0 +1,140 @@
+#!/bin/bash
+## Regression checks. Each check runs the program on the small test
+## data in two ways that must give identical output files, and prints
+## PASS or FAIL. The script exits with a non-zero status if any check
+## fails.
+prog="../bin/tmf"
+sample="../bin/tmf-sample"
+merge="../bin/tmf-merge"
+
+for p in ${prog} ${sample} ${merge}; do
+    if [ ! -e "${p}" ]; then
+        echo "Error: Program file '${p}' does not exist."
+        echo "Please run 'make' in directory '../src'."
+        exit 1
+    fi
+done
+
+# Input data files and parameters, as in test_small.sh.
+data_file='test_data.dat'
+node_types='node_types.dat'
+tw=10
+motif_size=3
+
+work=$(mktemp -d)
+trap 'rm -rf "${work}"' EXIT
+failed=0
+
+# Report the result of a check: the first argument is the name of the
+# check, the rest is the command that must succeed.
+check() {
+    local name=$1; shift
+    if "$@" > /dev/null 2>&1; then
+        echo "PASS: ${name}"
+    else
+        echo "FAIL: ${name}"
+        failed=1
+    fi
+}
+
+# Compare two files.
+check_same() {
+    check "$1" cmp "$2" "$3"
+}
+
+# Succeed if the command fails.
+fails() {
+    ! "$@"
+}
+
+# Run tmf with the common parameters. The first argument is the
+# output name (in the work directory), the rest are extra options.
+run() {
+    local out=$1; shift
+    ${prog} ${tw} ${work}/${out} -m ${motif_size} -nf ${node_types} "$@" < ${data_file} > ${work}/${out}.log 2>&1
+}
+
+# The reference output that most checks compare against.
+run plain -r 20 -s 1
+
+# References created from a state file with tmf-sample and combined
+# with tmf-merge. tmf-merge must refuse the same references twice and
+# references from another state file.
+run state -r 0 -s 1 --save_state ${work}/state
+${sample} ${work}/state ${work}/refs -r 20 -s 1 > /dev/null 2>&1
+${merge} ${work}/merged ${work}/state ${work}/refs > /dev/null 2>&1
+check_same "tmf-sample and tmf-merge" ${work}/plain.dat ${work}/merged.dat
+check "tmf-merge (same references twice)" fails ${merge} ${work}/merged_twice ${work}/state ${work}/refs ${work}/refs
+${prog} $((tw * 100)) ${work}/other -m ${motif_size} -nf ${node_types} -r 0 --save_state ${work}/state_other < ${data_file} > /dev/null 2>&1
+check "tmf-merge (other state file)" fails ${merge} ${work}/merged_other ${work}/state_other ${work}/refs
+
+# References split into two ranges with the same seed and '--first'.
+${sample} ${work}/state ${work}/refs_a -r 7 -s 1 --first 0 > /dev/null 2>&1
+${sample} ${work}/state ${work}/refs_b -r 13 -s 1 --first 7 > /dev/null 2>&1
+${merge} ${work}/merged_ab ${work}/state ${work}/refs_a ${work}/refs_b > /dev/null 2>&1
+check_same "tmf-sample --first" ${work}/plain.dat ${work}/merged_ab.dat
+
+# Time-shuffled ensembles do not depend on the number of threads.
+OMP_NUM_THREADS=1 run ensemble_1 --ensemble 5 -st 2 -s 1
+OMP_NUM_THREADS=3 run ensemble_3 --ensemble 5 -st 2 -s 1
+check_same "--ensemble 5 -st 2" ${work}/ensemble_1.dat ${work}/ensemble_3.dat
+
+# Location cache: the first run writes it, the second reads it.
+run cache_1 -r 20 -s 1 --location_cache ${work}/cache
+run cache_2 -r 20 -s 1 --location_cache ${work}/cache
+check_same "--location_cache (write)" ${work}/plain.dat ${work}/cache_1.dat
+check_same "--location_cache (read)" ${work}/plain.dat ${work}/cache_2.dat
+check "--location_cache (read from cache)" grep -q "^Read .* locations from cache" ${work}/cache_2.log
+
+# Node-type permutation ensembles do not depend on the number of threads.
+OMP_NUM_THREADS=1 run ensemble_nodes_1 --ensemble 5 -st 0 -s 1
+OMP_NUM_THREADS=3 run ensemble_nodes_3 --ensemble 5 -st 0 -s 1
+check_same "--ensemble 5 -st 0" ${work}/ensemble_nodes_1.dat ${work}/ensemble_nodes_3.dat
+
+# Edge-type shuffle ensembles do not depend on the number of threads.
+OMP_NUM_THREADS=1 run ensemble_edges_1 --ensemble 5 -st -1 -s 1
+OMP_NUM_THREADS=3 run ensemble_edges_3 --ensemble 5 -st -1 -s 1
+check_same "--ensemble 5 -st -1" ${work}/ensemble_edges_1.dat ${work}/ensemble_edges_3.dat
+
+# All null hypotheses in one run.
+run hall -r 20 -s 1 -h all
+for h in 0 1 2; do
+    run h${h} -r 20 -s 1 -h ${h}
+    check_same "-h all (hypothesis ${h})" ${work}/h${h}.dat ${work}/hall_h${h}.dat
+done
+
+# Binary output has the same columns and motifs as the text output,
+# also with the string column of '--motif_structure'.
+python="python"
+run binary -r 20 -s 1 --binary_output
+check "--binary_output" ${python} compare_results.py ${work}/plain.dat ${work}/binary.bin
+run structure -r 20 -s 1 --motif_structure
+run structure_binary -r 20 -s 1 --motif_structure --binary_output
+check "--binary_output --motif_structure" ${python} compare_results.py ${work}/structure.dat ${work}/structure_binary.bin
+
+# Shards combined with '--shards', also for maximal motifs.
+run maximal -r 20 -s 1 --maximal
+for maximal in "" "--maximal"; do
+    name="shards${maximal/--/_}"
+    for i in 0 1 2; do
+        run ${name}_${i} -r 20 -s 1 ${maximal} --shard ${i}/3 --location_cache ${work}/${name}
+    done
+    run ${name} -r 20 -s 1 ${maximal} --shards 3 --location_cache ${work}/${name}
+done
+check_same "--shard/--shards" ${work}/plain.dat ${work}/shards.dat
+check_same "--shard/--shards --maximal" ${work}/maximal.dat ${work}/shards_maximal.dat
+
+# Checkpoints: a run resumed from the checkpoint of a finished search,
+# and one whose checkpoint was written with other parameters and must
+# be ignored.
+run checkpoint -r 20 -s 1 --checkpoint ${work}/checkpoint
+run resume -r 20 -s 1 --checkpoint ${work}/checkpoint --resume
+check_same "--checkpoint" ${work}/plain.dat ${work}/checkpoint.dat
+check_same "--resume" ${work}/plain.dat ${work}/resume.dat
+check "--resume (read checkpoint)" grep -q "^Resuming from checkpoint" ${work}/resume.log
+${prog} $((tw * 100)) ${work}/other -m ${motif_size} -nf ${node_types} -r 0 --checkpoint ${work}/checkpoint_other < ${data_file} > /dev/null 2>&1
+run resume_other -r 20 -s 1 --checkpoint ${work}/checkpoint_other --resume
+check_same "--resume (unusable checkpoint)" ${work}/plain.dat ${work}/resume_other.dat
+check "--resume (ignored checkpoint)" grep -q "^No usable checkpoint" ${work}/resume_other.log
+
+exit ${failed}